@@ -0,0 +1,206 @@
+// Microbenchmark and cross-check of the LEB128 decoding kernels in
+// cursor against straightforward byte-at-a-time decoders.
+
+#include "internal.hh"
+
+#include <chrono>
+#include <random>
+
+using namespace std;
+using namespace dwarf;
+
+// The byte-at-a-time decoders, as in DWARF4 Appendix C
+static uint64_t
+ref_uleb128(const char **pos, const char *end)
+{
+        uint64_t result = 0;
+        int shift = 0;
+        while (*pos < end) {
+                uint8_t byte = *(uint8_t*)((*pos)++);
+                result |= (uint64_t)(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                        return result;
+                shift += 7;
+        }
+        throw underflow_error("truncated");
+}
+
+static int64_t
+ref_sleb128(const char **pos, const char *end)
+{
+        uint64_t result = 0;
+        unsigned shift = 0;
+        while (*pos < end) {
+                uint8_t byte = *(uint8_t*)((*pos)++);
+                result |= (uint64_t)(byte & 0x7f) << shift;
+                shift += 7;
+                if ((byte & 0x80) == 0) {
+                        if (shift < sizeof(result)*8 && (byte & 0x40))
+                                result |= -((uint64_t)1 << shift);
+                        return result;
+                }
+        }
+        throw underflow_error("truncated");
+}
+
+static void
+ref_skip(const char **pos, const char *end)
+{
+        while (*pos < end && (**(uint8_t**)pos & 0x80))
+                (*pos)++;
+        (*pos)++;
+}
+
+static void
+put_uleb128(string *out, uint64_t v)
+{
+        do {
+                uint8_t byte = v & 0x7f;
+                v >>= 7;
+                if (v)
+                        byte |= 0x80;
+                out->push_back(byte);
+        } while (v);
+}
+
+static void
+put_sleb128(string *out, int64_t v)
+{
+        while (true) {
+                uint8_t byte = v & 0x7f;
+                v >>= 7;
+                if ((v == 0 && !(byte & 0x40)) || (v == -1 && (byte & 0x40))) {
+                        out->push_back(byte);
+                        return;
+                }
+                out->push_back(byte | 0x80);
+        }
+}
+
+struct workload
+{
+        const char *name;
+        bool is_signed;
+        // Maximum number of significant bits in values
+        unsigned max_bits;
+};
+
+static const workload workloads[] = {
+        {"1-byte unsigned", false, 7},
+        {"2-byte unsigned", false, 14},
+        {"mixed unsigned", false, 64},
+        {"1-byte signed", true, 7},
+        {"mixed signed", true, 64},
+};
+
+static const size_t count = 1 << 20;
+static const int iters = 20;
+
+template<typename Fn>
+static double
+best_time(Fn fn)
+{
+        double best = 0;
+        for (int i = 0; i < iters; i++) {
+                auto start = chrono::steady_clock::now();
+                fn();
+                chrono::duration<double> d = chrono::steady_clock::now() - start;
+                if (i == 0 || d.count() < best)
+                        best = d.count();
+        }
+        return best * 1e9 / count;
+}
+
+int
+main()
+{
+        mt19937_64 rng(42);
+        bool ok = true;
+        volatile uint64_t sink = 0;
+
+        printf("%-16s %10s %10s %10s %10s\n", "workload",
+               "ref ns", "fast ns", "ref skip", "bulk skip");
+        for (auto &w : workloads) {
+                // Generate values with a uniform distribution of bit
+                // lengths, so long values are well represented
+                string buf;
+                vector<uint64_t> values;
+                for (size_t i = 0; i < count; i++) {
+                        unsigned bits = 1 + rng() % w.max_bits;
+                        uint64_t v = rng() & (bits == 64 ? ~0ull : (1ull << bits) - 1);
+                        if (w.is_signed) {
+                                int64_t sv = (int64_t)(v << (64 - bits)) >> (64 - bits);
+                                if (w.max_bits <= 7)
+                                        sv = (int64_t)(v << 57) >> 57;
+                                values.push_back(sv);
+                                put_sleb128(&buf, sv);
+                        } else {
+                                values.push_back(v);
+                                put_uleb128(&buf, v);
+                        }
+                }
+                auto sec = make_shared<section>(section_type::info, buf.data(),
+                                                buf.size(), byte_order::lsb);
+                const char *end = sec->end;
+
+                // Cross-check every value, including those near the
+                // end of the buffer, where the kernels fall back to
+                // bounds-checked decoding
+                cursor cur(sec);
+                const char *rpos = sec->begin;
+                for (size_t i = 0; i < count; i++) {
+                        uint64_t got = w.is_signed ? cur.sleb128() : cur.uleb128();
+                        uint64_t want = w.is_signed ? ref_sleb128(&rpos, end)
+                                : ref_uleb128(&rpos, end);
+                        if (got != want || got != values[i] || cur.pos != rpos) {
+                                printf("%s: mismatch at value %zu\n", w.name, i);
+                                ok = false;
+                                break;
+                        }
+                }
+                for (size_t n : {1, 7, 8, 9, 1000}) {
+                        cursor c(sec);
+                        const char *r = sec->begin;
+                        c.skip_leb128s(n);
+                        for (size_t i = 0; i < n; i++)
+                                ref_skip(&r, end);
+                        if (c.pos != r) {
+                                printf("%s: skip %zu mismatch\n", w.name, n);
+                                ok = false;
+                        }
+                }
+
+                double ref = best_time([&]() {
+                                const char *p = sec->begin;
+                                uint64_t sum = 0;
+                                for (size_t i = 0; i < count; i++)
+                                        sum += w.is_signed ? ref_sleb128(&p, end)
+                                                : ref_uleb128(&p, end);
+                                sink = sum;
+                        });
+                double fast = best_time([&]() {
+                                cursor c(sec);
+                                uint64_t sum = 0;
+                                for (size_t i = 0; i < count; i++)
+                                        sum += w.is_signed ? c.sleb128() : c.uleb128();
+                                sink = sum;
+                        });
+                double ref_skip_ns = best_time([&]() {
+                                const char *p = sec->begin;
+                                for (size_t i = 0; i < count; i++)
+                                        ref_skip(&p, end);
+                                sink = (uintptr_t)p;
+                        });
+                double bulk = best_time([&]() {
+                                // Skip in runs of four, like adjacent
+                                // LEB128 attributes
+                                cursor c(sec);
+                                for (size_t i = 0; i < count; i += 4)
+                                        c.skip_leb128s(4);
+                                sink = (uintptr_t)c.pos;
+                        });
+                printf("%-16s %10.2f %10.2f %10.2f %10.2f\n", w.name,
+                       ref, fast, ref_skip_ns, bulk);
+        }
+        return ok ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+// Benchmark a full traversal of the DIE trees of a file.
+//
+// Every DIE read and every attribute value decoded constructs
+// cursors, so this is sensitive to per-cursor overheads such as
+// reference counting the section a cursor points into.
+
+#include "elf++.hh"
+#include "dwarf++.hh"
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+
+using namespace std;
+
+static size_t dies, names;
+
+static void
+walk(const dwarf::die &node)
+{
+        dies++;
+        if (node.has(dwarf::DW_AT::name)) {
+                node[dwarf::DW_AT::name].as_cstr();
+                names++;
+        }
+        for (auto &child : node)
+                walk(child);
+}
+
+int
+main(int argc, char **argv)
+{
+        if (argc < 2 || argc > 3) {
+                fprintf(stderr, "usage: %s elf-file [iterations]\n", argv[0]);
+                return 2;
+        }
+        int iters = argc == 3 ? atoi(argv[2]) : 10;
+
+        int fd = open(argv[1], O_RDONLY);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+                return 1;
+        }
+
+        elf::elf ef(elf::create_mmap_loader(fd));
+        dwarf::dwarf dw(dwarf::elf::create_loader(ef));
+
+        // Warm up lazily loaded state, like abbrev tables
+        for (auto &cu : dw.compilation_units())
+                walk(cu.root());
+
+        double best = 0;
+        for (int i = 0; i < iters; i++) {
+                dies = names = 0;
+                auto start = chrono::steady_clock::now();
+                for (auto &cu : dw.compilation_units())
+                        walk(cu.root());
+                chrono::duration<double> d = chrono::steady_clock::now() - start;
+                if (i == 0 || d.count() < best)
+                        best = d.count();
+        }
+
+        printf("%zu DIEs, %zu names\n", dies, names);
+        printf("best of %d: %.3f ms, %.1f ns/DIE\n",
+               iters, best * 1e3, best * 1e9 / dies);
+        return 0;
+}
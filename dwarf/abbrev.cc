@@ -4,6 +4,8 @@
 
 #include "internal.hh"
 
+#include <algorithm>
+
 using namespace std;
 
 DWARFPP_BEGIN_NAMESPACE
@@ -146,31 +148,221 @@ resolve_type(DW_AT name, DW_FORM form)
 }
 
 attribute_spec::attribute_spec(DW_AT name, DW_FORM form)
-        : name(name), form(form), type(resolve_type(name, form))
+        : name(name), form(form), type(resolve_type(name, form)),
+          variable(true), offset(0)
 {
 }
 
-bool
-abbrev_entry::read(cursor *cur)
+/**
+ * Return the size of form in a unit with the given address size and
+ * format, or -1 if form does not have a fixed size.  This must agree
+ * with cursor::skip_form.
+ */
+static int
+fixed_form_size(DW_FORM form, unsigned addr_size, format fmt)
 {
-        attributes.clear();
-
-        // Section 7.5.3
-        code = cur->uleb128();
-        if (!code)
-                return false;
-
-        tag = (DW_TAG)cur->uleb128();
-        children = cur->fixed<DW_CHILDREN>() == DW_CHILDREN::yes;
-        while (1) {
-                DW_AT name = (DW_AT)cur->uleb128();
-                DW_FORM form = (DW_FORM)cur->uleb128();
-                if (name == (DW_AT)0 && form == (DW_FORM)0)
+        // Section 7.5.4
+        switch (form) {
+        case DW_FORM::addr:
+                return addr_size;
+        case DW_FORM::sec_offset:
+        case DW_FORM::ref_addr:
+        case DW_FORM::strp:
+                switch (fmt) {
+                case format::dwarf32:
+                        return 4;
+                case format::dwarf64:
+                        return 8;
+                case format::unknown:
+                        return -1;
+                }
+                return -1;
+        case DW_FORM::flag_present:
+                return 0;
+        case DW_FORM::flag:
+        case DW_FORM::data1:
+        case DW_FORM::ref1:
+                return 1;
+        case DW_FORM::data2:
+        case DW_FORM::ref2:
+                return 2;
+        case DW_FORM::data4:
+        case DW_FORM::ref4:
+                return 4;
+        case DW_FORM::data8:
+        case DW_FORM::ref8:
+        case DW_FORM::ref_sig8:
+                return 8;
+        default:
+                return -1;
+        }
+}
+
+abbrev_table::abbrev_table(cursor cur, unsigned addr_size, format fmt)
+{
+        // Section 7.5.3.  Entries refer to their attributes by index
+        // until all of the specs have been read and won't move.
+        vector<pair<size_t, size_t> > spans;
+        abbrev_code highest = 0;
+        while (true) {
+                abbrev_entry entry;
+                entry.code = cur.uleb128();
+                if (!entry.code)
                         break;
-                attributes.push_back(attribute_spec(name, form));
+                entry.tag = (DW_TAG)cur.uleb128();
+                entry.children = cur.fixed<DW_CHILDREN>() == DW_CHILDREN::yes;
+                size_t first = specs.size();
+                // Compile the decode plan.  Runs of fixed-size
+                // attributes are located by constant offsets from the
+                // end of the last variable-size attribute.
+                uint32_t offset = 0;
+                while (1) {
+                        DW_AT name = (DW_AT)cur.uleb128();
+                        DW_FORM form = (DW_FORM)cur.uleb128();
+                        if (name == (DW_AT)0 && form == (DW_FORM)0)
+                                break;
+                        attribute_spec spec(name, form);
+                        int size = fixed_form_size(form, addr_size, fmt);
+                        spec.variable = size < 0;
+                        spec.offset = offset;
+                        offset = spec.variable ? 0 : offset + size;
+                        specs.push_back(spec);
+                }
+                entry.fixed_tail = offset;
+                spans.push_back(make_pair(first, specs.size()));
+                entries.push_back(entry);
+                if (entry.code > highest)
+                        highest = entry.code;
+        }
+        specs.shrink_to_fit();
+
+        // Build each entry's attribute lookup tables.  Like the
+        // specs, these refer to the flat arrays by index until the
+        // arrays are complete.
+        vector<pair<size_t, size_t> > lookups;
+        for (size_t i = 0; i < entries.size(); i++) {
+                abbrev_entry &entry = entries[i];
+                lookups.push_back(make_pair(common_slots.size(),
+                                            vendor_slots.size()));
+                vector<pair<DW_AT, uint16_t> > common, vendor;
+                for (size_t j = spans[i].first; j < spans[i].second; j++) {
+                        DW_AT name = specs[j].name;
+                        unsigned n = (unsigned)name;
+                        uint16_t slot = j - spans[i].first;
+                        if (j - spans[i].first > UINT16_MAX)
+                                throw format_error("too many attributes in abbrev");
+                        // A well-formed abbrev has no duplicate
+                        // attributes, but if it does, the first one
+                        // wins, as for a linear scan.
+                        if (n < abbrev_entry::num_common) {
+                                uint64_t bit = (uint64_t)1 << (n % 64);
+                                if (entry.common[n / 64] & bit)
+                                        continue;
+                                entry.common[n / 64] |= bit;
+                                common.push_back(make_pair(name, slot));
+                        } else {
+                                bool dup = false;
+                                for (auto &v : vendor)
+                                        dup = dup || v.first == name;
+                                if (!dup)
+                                        vendor.push_back(make_pair(name, slot));
+                        }
+                }
+
+                // Order the common slots by rank
+                sort(common.begin(), common.end());
+                for (auto &c : common)
+                        common_slots.push_back(c.second);
+
+                if (vendor.empty())
+                        continue;
+                // Find a multiplier that hashes the vendor attributes
+                // without collisions, growing the table if we can't
+                // find one quickly.  Vendor attributes are rare and
+                // there are at most a few per abbrev, so this almost
+                // always succeeds on the first multiplier.  At 32
+                // bits the hash is a bijection, so this terminates.
+                unsigned bits = 1;
+                while ((1u << bits) < 2 * vendor.size())
+                        bits++;
+                uint32_t mult = 0;
+                vector<bool> used;
+                for (;; bits++) {
+                        for (unsigned attempt = 0; attempt < 64; attempt++) {
+                                uint32_t m = 0x9e3779b1u + 2 * attempt;
+                                used.assign((size_t)1 << bits, false);
+                                bool ok = true;
+                                for (auto &v : vendor) {
+                                        unsigned h = abbrev_entry::vendor_hash(
+                                                v.first, m, bits);
+                                        if (used[h]) {
+                                                ok = false;
+                                                break;
+                                        }
+                                        used[h] = true;
+                                }
+                                if (ok) {
+                                        mult = m;
+                                        break;
+                                }
+                        }
+                        if (mult)
+                                break;
+                }
+                size_t base = vendor_slots.size();
+                vendor_slots.resize(base + ((size_t)1 << bits),
+                                    abbrev_entry::vendor_slot{(DW_AT)0, 0});
+                for (auto &v : vendor)
+                        vendor_slots[base + abbrev_entry::vendor_hash(
+                                        v.first, mult, bits)] = {v.first, v.second};
+                entry.vendor_bits = bits;
+                entry.vendor_mult = mult;
+        }
+        common_slots.shrink_to_fit();
+        vendor_slots.shrink_to_fit();
+
+        for (size_t i = 0; i < entries.size(); i++) {
+                entries[i].attributes.first = specs.data() + spans[i].first;
+                entries[i].attributes.last = specs.data() + spans[i].second;
+                entries[i].common_slots = common_slots.data() + lookups[i].first;
+                if (entries[i].vendor_bits)
+                        entries[i].vendor = vendor_slots.data() + lookups[i].second;
+        }
+
+        // Typically, abbrev codes are assigned linearly, so it's more
+        // space efficient and time efficient to index the table
+        // directly by code.  Do that if it's dense enough, by some
+        // rough estimate of "enough".
+        dense = highest * 10 < entries.size() * 15;
+        if (dense) {
+                vector<abbrev_entry> by_code(highest + 1);
+                for (auto &entry : entries)
+                        by_code[entry.code] = entry;
+                entries = move(by_code);
+        } else {
+                stable_sort(entries.begin(), entries.end(),
+                            [](const abbrev_entry &a, const abbrev_entry &b) {
+                                    return a.code < b.code;
+                            });
+                entries.shrink_to_fit();
+        }
+}
+
+const abbrev_entry *
+abbrev_table::find(abbrev_code code) const
+{
+        if (dense) {
+                if (code >= entries.size() || entries[code].code == 0)
+                        return nullptr;
+                return &entries[code];
         }
-        attributes.shrink_to_fit();
-        return true;
+        auto it = lower_bound(entries.begin(), entries.end(), code,
+                              [](const abbrev_entry &e, abbrev_code c) {
+                                      return e.code < c;
+                              });
+        if (it == entries.end() || it->code != code)
+                return nullptr;
+        return &*it;
 }
 
 DWARFPP_END_NAMESPACE
@@ -0,0 +1,268 @@
+// Copyright (c) 2013 Austin T. Clements. All rights reserved.
+// Use of this source code is governed by an MIT license
+// that can be found in the LICENSE file.
+
+#include "internal.hh"
+
+#include <algorithm>
+#include <unordered_set>
+
+using namespace std;
+
+DWARFPP_BEGIN_NAMESPACE
+
+struct address_index::impl
+{
+        vector<range> ranges;
+        vector<range> overlaps, gaps;
+
+        void normalize();
+        void add_units(const vector<const compilation_unit*> &units,
+                       unsigned nthreads);
+};
+
+/**
+ * Sort the ranges and make them disjoint.  Where ranges overlap, the
+ * range that starts first keeps the overlapping addresses and
+ * overlaps between different compilation units are recorded.
+ * Adjacent ranges belonging to the same compilation unit are
+ * coalesced.
+ */
+void
+address_index::impl::normalize()
+{
+        stable_sort(ranges.begin(), ranges.end(),
+                    [](const range &a, const range &b) {
+                            return a.low < b.low;
+                    });
+
+        vector<range> out;
+        out.reserve(ranges.size());
+        for (range r : ranges) {
+                // Since out is disjoint and sorted, r can only
+                // overlap the last range in out.
+                if (!out.empty() && r.low < out.back().high) {
+                        if (out.back().cu_offset != r.cu_offset)
+                                overlaps.push_back(
+                                        {r.low, min(r.high, out.back().high),
+                                         r.cu_offset});
+                        r.low = out.back().high;
+                }
+                if (r.low >= r.high)
+                        continue;
+                if (!out.empty() && out.back().high == r.low &&
+                    out.back().cu_offset == r.cu_offset)
+                        out.back().high = r.high;
+                else
+                        out.push_back(r);
+        }
+        out.shrink_to_fit();
+        ranges = move(out);
+}
+
+address_index
+address_index::from_aranges(const dwarf &file)
+{
+        address_index res;
+        res.m = make_shared<impl>();
+
+        cursor cur(file.get_section(section_type::aranges));
+        while (!cur.end()) {
+                // Read an address range table set header (DWARF4
+                // sections 6.1.2 and 7.20)
+                shared_ptr<section> subsec = cur.subsection();
+                cursor sub(subsec);
+                sub.skip_initial_length();
+                uhalf version = sub.fixed<uhalf>();
+                if (version != 2)
+                        throw format_error("unknown address range table version " +
+                                           std::to_string(version));
+                section_offset cu_offset = sub.offset();
+                ubyte address_size = sub.fixed<ubyte>();
+                ubyte segment_size = sub.fixed<ubyte>();
+                if (address_size == 0)
+                        throw format_error("address range table has address size 0");
+                subsec->set_addr_size(address_size);
+
+                // The first tuple begins at an offset that is a
+                // multiple of the tuple size.
+                section_length tuple_size = segment_size + 2 * address_size;
+                section_offset first = sub.get_section_offset();
+                first = (first + tuple_size - 1) / tuple_size * tuple_size;
+                sub = cursor(subsec, first);
+
+                while (!sub.end()) {
+                        sub += segment_size;
+                        taddr addr = sub.address();
+                        taddr length = sub.address();
+                        if (addr == 0 && length == 0)
+                                break;
+                        if (length == 0)
+                                continue;
+                        res.m->ranges.push_back({addr, addr + length, cu_offset});
+                }
+        }
+
+        res.m->normalize();
+        return res;
+}
+
+/**
+ * Add the ranges of the root DIEs of units to this index.  The root
+ * DIEs are read in parallel.  The caller is responsible for
+ * normalizing the index afterwards.
+ */
+void
+address_index::impl::add_units(const vector<const compilation_unit*> &units,
+                               unsigned nthreads)
+{
+        // Each unit is handled by exactly one thread, so it's safe
+        // for the unit to lazily load its abbrevs and root DIE.
+        vector<vector<range> > unit_ranges(units.size());
+        parallel_for(units.size(), nthreads, [&](size_t i) {
+                        const die &root = units[i]->root();
+                        if (!root.has(DW_AT::ranges) && !root.has(DW_AT::low_pc))
+                                return;
+                        section_offset cu_offset = units[i]->get_section_offset();
+                        for (auto &ent : die_pc_range(root))
+                                unit_ranges[i].push_back({ent.low, ent.high, cu_offset});
+                });
+
+        for (auto &rs : unit_ranges)
+                ranges.insert(ranges.end(), rs.begin(), rs.end());
+}
+
+address_index
+address_index::from_units(const dwarf &file, unsigned nthreads)
+{
+        address_index res;
+        res.m = make_shared<impl>();
+
+        vector<const compilation_unit*> units;
+        for (auto &cu : file.compilation_units())
+                units.push_back(&cu);
+        res.m->add_units(units, nthreads);
+        res.m->normalize();
+        return res;
+}
+
+address_index
+address_index::merge(const address_index &primary,
+                     const address_index &fallback)
+{
+        address_index res;
+        res.m = make_shared<impl>();
+        res.m->ranges = primary.ranges();
+        res.m->overlaps = primary.overlaps();
+        res.m->overlaps.insert(res.m->overlaps.end(),
+                               fallback.overlaps().begin(),
+                               fallback.overlaps().end());
+        res.m->gaps = primary.gaps();
+
+        // Both indexes are sorted and disjoint, so we can subtract
+        // primary from each fallback range in a single pass over
+        // primary.
+        const vector<range> &prim = primary.ranges();
+        auto pit = prim.begin();
+        for (const range &r : fallback.ranges()) {
+                while (pit != prim.end() && pit->high <= r.low)
+                        ++pit;
+                taddr low = r.low;
+                for (auto it = pit; low < r.high; ++it) {
+                        if (it == prim.end() || it->low >= r.high) {
+                                res.m->gaps.push_back({low, r.high, r.cu_offset});
+                                break;
+                        }
+                        if (low < it->low) {
+                                res.m->gaps.push_back({low, it->low, r.cu_offset});
+                                low = it->low;
+                        }
+                        taddr high = min(r.high, it->high);
+                        if (it->cu_offset != r.cu_offset)
+                                res.m->overlaps.push_back({low, high, r.cu_offset});
+                        low = high;
+                }
+        }
+
+        auto by_low = [](const range &a, const range &b) {
+                return a.low < b.low;
+        };
+        res.m->ranges.insert(res.m->ranges.end(),
+                             res.m->gaps.begin(), res.m->gaps.end());
+        res.m->normalize();
+        sort(res.m->overlaps.begin(), res.m->overlaps.end(), by_low);
+        sort(res.m->gaps.begin(), res.m->gaps.end(), by_low);
+        return res;
+}
+
+address_index
+address_index::fill_missing_units(const address_index &primary,
+                                  const dwarf &file, unsigned nthreads)
+{
+        unordered_set<section_offset> mentioned;
+        for (auto &r : primary.ranges())
+                mentioned.insert(r.cu_offset);
+
+        // Check the unit header offsets first so that only the
+        // missing units get constructed
+        vector<const compilation_unit*> missing;
+        for (section_offset off : file.compilation_unit_offsets())
+                if (!mentioned.count(off))
+                        missing.push_back(&file.find_unit_by_offset(off));
+        if (missing.empty() && primary.m)
+                return primary;
+
+        address_index fallback;
+        fallback.m = make_shared<impl>();
+        fallback.m->add_units(missing, nthreads);
+        fallback.m->normalize();
+        return merge(primary, fallback);
+}
+
+bool
+address_index::find(taddr addr, section_offset *cu_offset_out) const
+{
+        if (!m)
+                return false;
+
+        auto it = upper_bound(m->ranges.begin(), m->ranges.end(), addr,
+                              [](taddr a, const range &r) {
+                                      return a < r.low;
+                              });
+        if (it == m->ranges.begin())
+                return false;
+        --it;
+        if (addr >= it->high)
+                return false;
+        *cu_offset_out = it->cu_offset;
+        return true;
+}
+
+const vector<address_index::range> &
+address_index::ranges() const
+{
+        static const vector<range> empty;
+        if (!m)
+                return empty;
+        return m->ranges;
+}
+
+const vector<address_index::range> &
+address_index::overlaps() const
+{
+        static const vector<range> empty;
+        if (!m)
+                return empty;
+        return m->overlaps;
+}
+
+const vector<address_index::range> &
+address_index::gaps() const
+{
+        static const vector<range> empty;
+        if (!m)
+                return empty;
+        return m->gaps;
+}
+
+DWARFPP_END_NAMESPACE
@@ -264,4 +264,10 @@ die_pc_range(const die &d)
         return rangelist({{low, high}});
 }
 
+rangelist
+die_cached_pc_range(const die &d)
+{
+        return d.get_unit().cached_pc_range(d);
+}
+
 DWARFPP_END_NAMESPACE
@@ -0,0 +1,337 @@
+// Copyright (c) 2013 Austin T. Clements. All rights reserved.
+// Use of this source code is governed by an MIT license
+// that can be found in the LICENSE file.
+
+#include "internal.hh"
+
+#include <unordered_map>
+
+using namespace std;
+
+DWARFPP_BEGIN_NAMESPACE
+
+const uint32_t indexed_name::none;
+
+/**
+ * Return the string value of d's attr attribute, or nullptr if d
+ * has no such attribute or it is not a string.
+ */
+static const char *
+str_attr(const die &d, DW_AT attr)
+{
+        if (!d.has(attr))
+                return nullptr;
+        value v = d[attr];
+        if (v.get_type() != value::type::string)
+                return nullptr;
+        return v.as_cstr();
+}
+
+static bool
+flag_attr(const die &d, DW_AT attr)
+{
+        return d.has(attr) && d[attr].as_flag();
+}
+
+/**
+ * Return the DIE that d's attr attribute refers to if it is in the
+ * same unit.  Otherwise, return an invalid DIE.  Following only
+ * unit-local references keeps collect_names from touching other
+ * units, which may be in use by other threads.
+ */
+static die
+local_reference(const die &d, DW_AT attr)
+{
+        if (!d.has(attr))
+                return die();
+        value v = d[attr];
+        switch (v.get_form()) {
+        case DW_FORM::ref1:
+        case DW_FORM::ref2:
+        case DW_FORM::ref4:
+        case DW_FORM::ref8:
+        case DW_FORM::ref_udata:
+                return v.as_reference();
+        default:
+                return die();
+        }
+}
+
+/**
+ * Return true if variable DIE d has a location in static storage
+ * (its location is an address or a thread-local storage offset).
+ */
+static bool
+has_static_location(const die &d)
+{
+        if (!d.has(DW_AT::location))
+                return false;
+        value loc = d[DW_AT::location];
+        if (loc.get_type() != value::type::exprloc &&
+            loc.get_type() != value::type::block)
+                return false;
+        size_t size;
+        const unsigned char *ops = (const unsigned char*)loc.as_block(&size);
+        if (size == 0)
+                return false;
+        // 0xe0 is DW_OP_GNU_push_tls_address, which GCC uses in
+        // place of DW_OP::form_tls_address
+        return ops[0] == (unsigned char)DW_OP::addr ||
+                ops[size - 1] == (unsigned char)DW_OP::form_tls_address ||
+                ops[size - 1] == 0xe0;
+}
+
+namespace {
+        struct name_collector
+        {
+                vector<indexed_name> *out;
+                // Whether types can enclose other names in this
+                // unit's language
+                bool scoped_types;
+                // The enclosing scope of each subprogram, variable,
+                // and member DIE visited so far, by unit offset
+                unordered_map<section_offset, uint32_t> scope_of;
+
+                void walk(const die &parent, uint32_t scope, bool local);
+                uint32_t add(const die &d, const char *name, uint32_t scope,
+                             bool local, bool declaration);
+                indexed_name resolve(const die &d, uint32_t scope, bool local);
+        };
+}
+
+uint32_t
+name_collector::add(const die &d, const char *name, uint32_t scope,
+                    bool local, bool declaration)
+{
+        indexed_name rec;
+        rec.name = name;
+        rec.linkage_name = nullptr;
+        rec.die_offset = d.get_unit_offset();
+        rec.tag = d.tag;
+        rec.is_static = local;
+        rec.local = local;
+        rec.declaration = declaration;
+        rec.parent = scope;
+        out->push_back(rec);
+        return out->size() - 1;
+}
+
+/**
+ * Build the name record for a function or variable DIE d that
+ * appears in scope (and in a function if local).  The name, linkage
+ * name, external flag and scope come from the first DIE that provides
+ * them along the chain of DW_AT::specification and
+ * DW_AT::abstract_origin references starting at d.
+ */
+indexed_name
+name_collector::resolve(const die &d, uint32_t scope, bool local)
+{
+        indexed_name rec;
+        rec.name = rec.linkage_name = nullptr;
+        rec.die_offset = d.get_unit_offset();
+        rec.tag = d.tag;
+        rec.local = local;
+        rec.declaration = false;
+
+        bool have_external = false, external = false, have_scope = false;
+        die cur = d;
+        // Chains are short in practice.  The limit protects against
+        // cycles in malformed input.
+        for (int hop = 0; cur.valid() && hop < 8; hop++) {
+                if (!rec.name)
+                        rec.name = str_attr(cur, DW_AT::name);
+                if (!rec.linkage_name)
+                        rec.linkage_name = str_attr(cur, DW_AT::linkage_name);
+                if (!rec.linkage_name)
+                        // DW_AT_MIPS_linkage_name, used before DWARF 4
+                        rec.linkage_name = str_attr(cur, (DW_AT)0x2007);
+                if (!have_external && cur.has(DW_AT::external)) {
+                        have_external = true;
+                        external = cur[DW_AT::external].as_flag();
+                }
+                if (hop > 0 && !have_scope) {
+                        auto it = scope_of.find(cur.get_unit_offset());
+                        if (it != scope_of.end()) {
+                                have_scope = true;
+                                scope = it->second;
+                        }
+                }
+                die next = local_reference(cur, DW_AT::specification);
+                if (!next.valid())
+                        next = local_reference(cur, DW_AT::abstract_origin);
+                cur = next;
+        }
+        rec.is_static = local || !external;
+        rec.parent = scope;
+        return rec;
+}
+
+void
+name_collector::walk(const die &parent, uint32_t scope, bool local)
+{
+        for (auto &d : parent) {
+                switch (d.tag) {
+                case DW_TAG::namespace_: {
+                        const char *name = str_attr(d, DW_AT::name);
+                        uint32_t self = add(d, name ? name : "(anonymous namespace)",
+                                            scope, local, false);
+                        walk(d, self, local);
+                        break;
+                }
+
+                case DW_TAG::class_type:
+                case DW_TAG::structure_type:
+                case DW_TAG::union_type:
+                case DW_TAG::enumeration_type:
+                case DW_TAG::interface_type: {
+                        const char *name = str_attr(d, DW_AT::name);
+                        if (!name) {
+                                // Members of anonymous types belong
+                                // to the enclosing scope
+                                walk(d, scope, local);
+                                break;
+                        }
+                        uint32_t self = add(d, name, scope, local,
+                                            flag_attr(d, DW_AT::declaration));
+                        walk(d, scoped_types ? self : indexed_name::none, local);
+                        break;
+                }
+
+                case DW_TAG::base_type:
+                case DW_TAG::typedef_:
+                case DW_TAG::unspecified_type:
+                case DW_TAG::string_type:
+                case DW_TAG::subrange_type:
+                case DW_TAG::set_type:
+                case DW_TAG::file_type:
+                case DW_TAG::pointer_type:
+                case DW_TAG::reference_type:
+                case DW_TAG::rvalue_reference_type:
+                case DW_TAG::ptr_to_member_type: {
+                        if (flag_attr(d, DW_AT::declaration))
+                                break;
+                        const char *name = str_attr(d, DW_AT::name);
+                        if (name)
+                                add(d, name, scope, local, false);
+                        break;
+                }
+
+                case DW_TAG::label: {
+                        const char *name = str_attr(d, DW_AT::name);
+                        if (name)
+                                add(d, name, scope, local, false);
+                        break;
+                }
+
+                case DW_TAG::subprogram: {
+                        if (flag_attr(d, DW_AT::declaration)) {
+                                scope_of[d.get_unit_offset()] = scope;
+                                break;
+                        }
+                        indexed_name rec = resolve(d, scope, local);
+                        scope_of[d.get_unit_offset()] = rec.parent;
+                        // Abstract instances of inline functions
+                        // have no code of their own
+                        if (rec.name && (d.has(DW_AT::low_pc) ||
+                                         d.has(DW_AT::ranges)))
+                                out->push_back(rec);
+                        walk(d, rec.parent, true);
+                        break;
+                }
+
+                case DW_TAG::inlined_subroutine: {
+                        indexed_name rec = resolve(d, scope, local);
+                        if (rec.name)
+                                out->push_back(rec);
+                        walk(d, scope, true);
+                        break;
+                }
+
+                case DW_TAG::member:
+                        // Possibly a static data member declaration
+                        scope_of[d.get_unit_offset()] = scope;
+                        break;
+
+                case DW_TAG::variable: {
+                        if (flag_attr(d, DW_AT::declaration)) {
+                                scope_of[d.get_unit_offset()] = scope;
+                                break;
+                        }
+                        if (!has_static_location(d))
+                                break;
+                        indexed_name rec = resolve(d, scope, local);
+                        if (rec.name)
+                                out->push_back(rec);
+                        break;
+                }
+
+                case DW_TAG::lexical_block:
+                        walk(d, scope, local);
+                        break;
+
+                default:
+                        break;
+                }
+        }
+}
+
+void
+collect_names(const compilation_unit &cu, vector<indexed_name> *out)
+{
+        name_collector c;
+        c.out = out;
+        c.scoped_types = false;
+        const die &root = cu.root();
+        if (root.has(DW_AT::language)) {
+                switch ((unsigned)root[DW_AT::language].as_uconstant()) {
+                case (unsigned)DW_LANG::C_plus_plus:
+                case (unsigned)DW_LANG::ObjC_plus_plus:
+                case (unsigned)DW_LANG::D:
+                case (unsigned)DW_LANG::Java:
+                // DWARF 5 C++03, C++11, and C++14
+                case 0x19:
+                case 0x1a:
+                case 0x21:
+                        c.scoped_types = true;
+                        break;
+                default:
+                        break;
+                }
+        }
+        c.walk(root, indexed_name::none, false);
+}
+
+void
+collect_unit_names(const dwarf &file, unsigned nthreads,
+                   vector<const compilation_unit*> *units,
+                   vector<vector<indexed_name> > *names)
+{
+        for (auto &cu : file.compilation_units())
+                units->push_back(&cu);
+        names->resize(units->size());
+        // Each unit is handled by exactly one thread, so it's safe
+        // for the unit to lazily load its abbrevs and DIEs.
+        parallel_for(units->size(), nthreads, [&](size_t i) {
+                        collect_names(*(*units)[i], &(*names)[i]);
+                });
+}
+
+string
+qualified_name(const vector<indexed_name> &names, uint32_t i)
+{
+        size_t len = 0;
+        uint32_t p;
+        for (p = i; p != indexed_name::none; p = names[p].parent)
+                len += strlen(names[p].name) + 2;
+        string res(len - 2, 0);
+        for (p = i; p != indexed_name::none; p = names[p].parent) {
+                size_t n = strlen(names[p].name);
+                len -= n + 2;
+                res.replace(len, n, names[p].name);
+                if (len)
+                        res.replace(len - 2, 2, "::");
+        }
+        return res;
+}
+
+DWARFPP_END_NAMESPACE
@@ -11,9 +11,110 @@ using namespace std;
 
 DWARFPP_BEGIN_NAMESPACE
 
+// The maximum length of a LEB128 encoding of a 64-bit value
+static const size_t max_leb128 = 10;
+
+/**
+ * Decode the LEB128 value at p without bounds checks, which requires
+ * that max_leb128 bytes are readable at p.  Returns the value's bits
+ * and sets *len to its length in bytes, or to 0 if the encoding is
+ * longer than max_leb128 bytes.  On little-endian hosts, this
+ * decodes up to eight bytes at once by finding the terminating byte
+ * in a word and compacting the 7-bit groups with shifts and masks.
+ */
+static inline uint64_t
+leb128_bits(const char *p, unsigned *len)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        uint64_t w;
+        memcpy(&w, p, sizeof w);
+        uint64_t stops = ~w & 0x8080808080808080ull;
+        unsigned n = 8;
+        if (stops) {
+                n = __builtin_ctzll(stops) / 8 + 1;
+                if (n < 8)
+                        w &= ((uint64_t)1 << (8 * n)) - 1;
+        }
+        uint64_t x = w & 0x7f7f7f7f7f7f7f7full;
+        x = (x & 0x007f007f007f007full) | ((x & 0x7f007f007f007f00ull) >> 1);
+        x = (x & 0x00003fff00003fffull) | ((x & 0x3fff00003fff0000ull) >> 2);
+        x = (x & 0x000000000fffffffull) | ((x & 0x0fffffff00000000ull) >> 4);
+        if (stops) {
+                *len = n;
+                return x;
+        }
+        // Nine or ten byte values
+        uint8_t b8 = p[8], b9 = p[9];
+        x |= (uint64_t)(b8 & 0x7f) << 56;
+        if (!(b8 & 0x80)) {
+                *len = 9;
+                return x;
+        }
+        x |= (uint64_t)b9 << 63;
+        *len = (b9 & 0x80) ? 0 : 10;
+        return x;
+#else
+        uint64_t x = 0;
+        for (unsigned i = 0; i < max_leb128; i++) {
+                uint8_t byte = p[i];
+                x |= (uint64_t)(byte & 0x7f) << (7 * i);
+                if (!(byte & 0x80)) {
+                        *len = i + 1;
+                        return x;
+                }
+        }
+        *len = 0;
+        return x;
+#endif
+}
+
+uint64_t
+cursor::uleb128_slow()
+{
+        // Hoist the bounds check if there's room for any value
+        if (sec->end - pos >= (ptrdiff_t)max_leb128) {
+                unsigned len;
+                uint64_t result = leb128_bits(pos, &len);
+                if (len) {
+                        pos += len;
+                        return result;
+                }
+        }
+
+        // Appendix C
+        uint64_t result = 0;
+        int shift = 0;
+        while (pos < sec->end) {
+                uint8_t byte = *(uint8_t*)(pos++);
+                result |= (uint64_t)(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                        return result;
+                shift += 7;
+        }
+        underflow();
+        return 0;
+}
+
 int64_t
 cursor::sleb128()
 {
+        if (pos < sec->end && !(*(uint8_t*)pos & 0x80)) {
+                // Single byte value; sign extend from bit 6
+                int64_t result = *(uint8_t*)(pos++);
+                return (result ^ 0x40) - 0x40;
+        }
+        if (sec->end - pos >= (ptrdiff_t)max_leb128) {
+                unsigned len;
+                uint64_t result = leb128_bits(pos, &len);
+                if (len) {
+                        unsigned shift = 7 * len;
+                        if (shift < sizeof(result)*8 && (pos[len - 1] & 0x40))
+                                result |= -((uint64_t)1 << shift);
+                        pos += len;
+                        return result;
+                }
+        }
+
         // Appendix C
         uint64_t result = 0;
         unsigned shift = 0;
@@ -31,8 +132,45 @@ cursor::sleb128()
         return 0;
 }
 
+void
+cursor::skip_leb128s(unsigned n)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // Count terminating bytes (those with a clear high bit) a
+        // word at a time
+        while (n && sec->end - pos >= 8) {
+                uint64_t w;
+                memcpy(&w, pos, sizeof w);
+                uint64_t stops = ~w & 0x8080808080808080ull;
+                for (; stops; stops &= stops - 1) {
+                        if (--n == 0) {
+                                pos += __builtin_ctzll(stops) / 8 + 1;
+                                return;
+                        }
+                }
+                pos += 8;
+        }
+#endif
+        for (; n; n--) {
+                while (pos < sec->end && (*(uint8_t*)pos & 0x80))
+                        pos++;
+                if (pos >= sec->end)
+                        underflow();
+                pos++;
+        }
+}
+
 shared_ptr<section>
 cursor::subsection()
+{
+        const char *begin = pos;
+        format fmt;
+        section_length length = skip_subsection(&fmt);
+        return make_shared<section>(sec->type, begin, length, sec->ord, fmt);
+}
+
+section_length
+cursor::skip_subsection(format *fmt_out)
 {
         // Section 7.4
         const char *begin = pos;
@@ -49,7 +187,9 @@ cursor::subsection()
                 throw format_error("initial length has reserved value");
         }
         pos = begin + length;
-        return make_shared<section>(sec->type, begin, length, sec->ord, fmt);
+        if (fmt_out)
+                *fmt_out = fmt;
+        return length;
 }
 
 void
@@ -171,6 +311,7 @@ cursor::skip_form(DW_FORM form)
                 pos += 4;
                 break;
         case DW_FORM::data8:
+        case DW_FORM::ref8:
         case DW_FORM::ref_sig8:
                 pos += 8;
                 break;
@@ -179,9 +320,7 @@ cursor::skip_form(DW_FORM form)
         case DW_FORM::sdata:
         case DW_FORM::udata:
         case DW_FORM::ref_udata:
-                while (pos < sec->end && (*(uint8_t*)pos & 0x80))
-                        pos++;
-                pos++;
+                skip_leb128s(1);
                 break;
         case DW_FORM::string:
                 while (pos < sec->end && *pos)
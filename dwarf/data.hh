@@ -560,6 +560,22 @@ enum class DW_LNE
 std::string
 to_string(DW_LNE v);
 
+// Name index attributes (DWARF5 section 7.19 table 7.23)
+enum class DW_IDX
+{
+        compile_unit = 0x01,
+        type_unit = 0x02,
+        die_offset = 0x03,
+        parent = 0x04,
+        type_hash = 0x05,
+
+        lo_user = 0x2000,
+        hi_user = 0x3fff,
+};
+
+std::string
+to_string(DW_IDX v);
+
 DWARFPP_END_NAMESPACE
 
 #endif
@@ -4,12 +4,14 @@
 
 #include "internal.hh"
 
+#include <algorithm>
+
 using namespace std;
 
 DWARFPP_BEGIN_NAMESPACE
 
 die::die(const unit *cu)
-        : cu(cu), abbrev(nullptr)
+        : cu(cu), abbrev(nullptr), index(die_index::none)
 {
 }
 
@@ -31,6 +33,7 @@ die::read(section_offset off)
         cursor cur(cu->data(), off);
 
         offset = off;
+        index = die_index::none;
 
         abbrev_code acode = cur.uleb128();
         if (acode == 0) {
@@ -42,41 +45,36 @@ die::read(section_offset off)
 
         tag = abbrev->tag;
 
-        // XXX We can pre-compute almost all of this work in the
-        // abbrev_entry.
+        // Follow the abbrev's decode plan.  Only variable-size
+        // attributes need to be scanned.
+        const char *begin = cu->data()->begin;
+        const char *base = cur.pos;
         attrs.clear();
         attrs.reserve(abbrev->attributes.size());
         for (auto &attr : abbrev->attributes) {
-                attrs.push_back(cur.get_section_offset());
-                cur.skip_form(attr.form);
+                attrs.push_back(base + attr.offset - begin);
+                if (attr.variable) {
+                        cur.pos = base + attr.offset;
+                        cur.skip_form(attr.form);
+                        base = cur.pos;
+                }
         }
-        next = cur.get_section_offset();
+        next = base + abbrev->fixed_tail - begin;
 }
 
 bool
 die::has(DW_AT attr) const
 {
-        if (!abbrev)
-                return false;
-        // XXX Totally lame
-        for (auto &a : abbrev->attributes)
-                if (a.name == attr)
-                        return true;
-        return false;
+        return abbrev && abbrev->find(attr) >= 0;
 }
 
 value
 die::operator[](DW_AT attr) const
 {
-        // XXX We can pre-compute almost all of this work in the
-        // abbrev_entry.
-        if (abbrev) {
-                int i = 0;
-                for (auto &a : abbrev->attributes) {
-                        if (a.name == attr)
-                                return value(cu, a.name, a.form, a.type, attrs[i]);
-                        i++;
-                }
+        int slot;
+        if (abbrev && (slot = abbrev->find(attr)) >= 0) {
+                const attribute_spec &a = abbrev->attributes[slot];
+                return value(cu, a.name, a.form, a.type, attrs[slot]);
         }
         throw out_of_range("DIE does not have attribute " + to_string(attr));
 }
@@ -93,9 +91,6 @@ die::resolve(DW_AT attr) const
         // completed by its abstract instance, so we first try to
         // resolve abstract_origin, then we resolve specification.
 
-        // XXX This traverses the abbrevs at least twice and
-        // potentially several more times
-
         if (has(attr))
                 return (*this)[attr];
 
@@ -122,7 +117,11 @@ die::begin() const
 {
         if (!abbrev || !abbrev->children)
                 return end();
-        return iterator(cu, next);
+        iterator it(cu, next);
+        // The first child immediately follows its parent
+        if (index != die_index::none && it.d.abbrev)
+                it.d.index = index + 1;
+        return it;
 }
 
 die::iterator::iterator(const unit *cu, section_offset off)
@@ -137,7 +136,14 @@ die::iterator::operator++()
         if (!d.abbrev)
                 return *this;
 
-        if (!d.abbrev->children) {
+        const die_index *index = d.cu->get_die_index();
+        if (index) {
+                // Skip the whole subtree using the index
+                uint32_t i = d.get_index();
+                uint32_t sibling = index->next_sibling[i];
+                d.read(index->subtree_end[i]);
+                d.index = sibling;
+        } else if (!d.abbrev->children) {
                 // The DIE has no children, so its successor follows
                 // immediately
                 d.read(d.next);
@@ -165,21 +171,162 @@ die::attributes() const
 {
         vector<pair<DW_AT, value> > res;
 
-        if (!abbrev)
-                return res;
-
-        // XXX Quite slow, especially when using this to traverse an
-        // entire DIE tree since each DIE will produce a new vector
-        // (whereas other vectors get reused).  Might be worth a
-        // custom iterator.
-        int i = 0;
-        for (auto &a : abbrev->attributes) {
-                res.push_back(make_pair(a.name, value(cu, a.name, a.form, a.type, attrs[i])));
-                i++;
-        }
+        // Prefer each_attribute when traversing an entire DIE tree,
+        // since this produces a new vector for each DIE.
+        attribute_range range = each_attribute();
+        res.reserve(range.size());
+        for (auto attr : range)
+                res.push_back(attr);
         return res;
 }
 
+die::attribute_range
+die::each_attribute() const
+{
+        size_t n = abbrev ? abbrev->attributes.size() : 0;
+        return attribute_range(attribute_iterator(this, 0),
+                               attribute_iterator(this, n));
+}
+
+pair<DW_AT, value>
+die::attribute_iterator::operator*() const
+{
+        const attribute_spec &a = d->abbrev->attributes[index];
+        return make_pair(a.name, value(d->cu, a.name, a.form, a.type,
+                                       d->attrs[index]));
+}
+
+die
+die::parent() const
+{
+        // get_index builds the index, so call it first
+        uint32_t i = get_index();
+        uint32_t p = cu->get_die_index()->parent[i];
+        if (p == die_index::none)
+                return die();
+        return cu->die_at(p);
+}
+
+unsigned
+die::depth() const
+{
+        uint32_t i = get_index();
+        return cu->get_die_index()->depth[i];
+}
+
+uint32_t
+die::get_index() const
+{
+        cu->enable_die_index();
+        if (index != die_index::none)
+                return index;
+        uint32_t i = cu->get_die_index()->find(offset);
+        if (i == die_index::none)
+                throw logic_error("DIE not found in DIE index");
+        return i;
+}
+
+const uint32_t die_index::none;
+
+static bool
+is_leb128_form(DW_FORM form)
+{
+        return form == DW_FORM::udata || form == DW_FORM::sdata ||
+                form == DW_FORM::ref_udata;
+}
+
+die_index::die_index(const unit &u)
+{
+        const shared_ptr<section> &data = u.data();
+        if (data->size() > none)
+                throw format_error("unit too large to index");
+
+        // Open DIEs whose children we're reading, and the last DIE
+        // read at each level of the tree
+        vector<uint32_t> open, last{none};
+        cursor cur(data, u.root().get_unit_offset());
+        while (!cur.end()) {
+                uint32_t off = cur.get_section_offset();
+                abbrev_code acode = cur.uleb128();
+                if (acode == 0) {
+                        // Sibling list terminator.  Anything after
+                        // the root DIE is padding.
+                        if (open.empty())
+                                break;
+                        if (last.back() != none)
+                                subtree_end[last.back()] = off;
+                        open.pop_back();
+                        last.pop_back();
+                        if (open.empty())
+                                break;
+                        continue;
+                }
+
+                const abbrev_entry *ab = &u.get_abbrev(acode);
+                uint32_t i = offset.size();
+                offset.push_back(off);
+                abbrev.push_back(ab);
+                parent.push_back(open.empty() ? none : open.back());
+                next_sibling.push_back(none);
+                depth.push_back(open.size());
+                // Overwritten when we find the end of the subtree,
+                // unless the unit is truncated
+                subtree_end.push_back(data->size());
+                if (last.back() != none) {
+                        next_sibling[last.back()] = i;
+                        subtree_end[last.back()] = off;
+                }
+                last.back() = i;
+
+                // Skip the attributes, following the abbrev's decode
+                // plan.  Adjacent LEB128 attributes are skipped
+                // together.
+                const char *base = cur.pos;
+                const attribute_spec *attr = ab->attributes.begin(),
+                        *attrs_end = ab->attributes.end();
+                while (attr != attrs_end) {
+                        if (!attr->variable) {
+                                ++attr;
+                                continue;
+                        }
+                        cur.pos = base + attr->offset;
+                        if (is_leb128_form(attr->form)) {
+                                unsigned n = 1;
+                                while (attr + n != attrs_end &&
+                                       attr[n].variable && attr[n].offset == 0 &&
+                                       is_leb128_form(attr[n].form))
+                                        n++;
+                                cur.skip_leb128s(n);
+                                attr += n;
+                        } else {
+                                cur.skip_form(attr->form);
+                                ++attr;
+                        }
+                        base = cur.pos;
+                }
+                cur.pos = base + ab->fixed_tail;
+
+                if (ab->children) {
+                        open.push_back(i);
+                        last.push_back(none);
+                } else if (open.empty()) {
+                        break;
+                }
+        }
+        // The root DIE's subtree ends where we stopped
+        if (!offset.empty())
+                subtree_end[0] = cur.get_section_offset();
+}
+
+uint32_t
+die_index::find(section_offset off) const
+{
+        auto it = lower_bound(offset.begin(), offset.end(), off);
+        if (it == offset.end() || *it != off)
+                return none;
+        return it - offset.begin();
+}
+
 bool
 die::operator==(const die &o) const
 {
@@ -192,6 +339,16 @@ die::operator!=(const die &o) const
         return !(*this == o);
 }
 
+die
+die_ref::get() const
+{
+        if (!cu)
+                return die();
+        die d(cu);
+        d.read(offset);
+        return d;
+}
+
 DWARFPP_END_NAMESPACE
 
 size_t
@@ -13,6 +13,7 @@
 #include "data.hh"
 #include "small_vector.hh"
 
+#include <functional>
 #include <initializer_list>
 #include <map>
 #include <memory>
@@ -34,10 +35,18 @@ class expr_context;
 class expr_result;
 class rangelist;
 class line_table;
+class compact_line_table;
+class line_index;
+class function_index;
+class address_index;
+class name_index;
+class gdb_index;
 
 // Internal type forward-declarations
 struct section;
 struct abbrev_entry;
+struct abbrev_table;
+struct die_index;
 struct cursor;
 
 // XXX Audit for binary-compatibility
@@ -55,8 +64,7 @@ struct cursor;
 
 // XXX Indicate DWARF4 in all spec references
 
-// XXX Big missing support: .debug_aranges, .debug_frame, loclists,
-// macros
+// XXX Big missing support: .debug_frame, loclists, macros
 
 //////////////////////////////////////////////////////////////////
 // DWARF files
@@ -76,7 +84,8 @@ public:
 
 /**
  * DWARF section types.  These correspond to the names of ELF
- * sections, though DWARF can be embedded in other formats.
+ * sections, though DWARF can be embedded in other formats.  New
+ * types are added at the end so existing values do not change.
  */
 enum class section_type
 {
@@ -92,11 +101,32 @@ enum class section_type
         ranges,
         str,
         types,
+        names,
+        gdb_index,
 };
 
 std::string
 to_string(section_type v);
 
+/**
+ * When a dwarf object should find and construct its compilation
+ * units.
+ */
+enum class unit_discovery
+{
+        /**
+         * Construct every compilation unit when the dwarf object is
+         * constructed.
+         */
+        eager,
+        /**
+         * Construct compilation units only when they are first
+         * needed.  This makes opening a file with many compilation
+         * units cheap when only a few of them will be used.
+         */
+        lazy,
+};
+
 /**
  * A DWARF file.  This class is internally reference counted and can
  * be efficiently copied.
@@ -110,9 +140,13 @@ class dwarf
 public:
         /**
          * Construct a DWARF file that is backed by sections read from
-         * the given loader.
+         * the given loader.  discovery controls whether the
+         * compilation units are constructed up front or as they are
+         * needed; either way, this object returns the same unit
+         * objects.
          */
-        explicit dwarf(const std::shared_ptr<loader> &l);
+        explicit dwarf(const std::shared_ptr<loader> &l,
+                       unit_discovery discovery = unit_discovery::eager);
 
         /**
          * Construct a DWARF file that is initially not valid.
@@ -149,22 +183,78 @@ public:
         // iterable collection over const references.
         /**
          * Return the list of compilation units in this DWARF file.
+         * If this file uses lazy unit discovery, this constructs any
+         * units that have not been needed yet.
          */
         const std::vector<compilation_unit> &compilation_units() const;
 
         /**
-         * Return the type unit with the given signature.  If the
-         * signature does not correspond to a type unit, throws
+         * Return the offsets of the compilation unit headers in
+         * .debug_info, in order.  This scans the unit headers, but
+         * does not construct any units.
+         */
+        const std::vector<section_offset> &compilation_unit_offsets() const;
+
+        /**
+         * Return the compilation unit whose header begins offset
+         * bytes into .debug_info.  If this file uses lazy unit
+         * discovery, this constructs only that unit, though the
+         * first call must still scan the unit headers to find where
+         * units begin.  If no unit begins at offset, throws
          * out_of_range.
          */
+        const compilation_unit &find_unit_by_offset(section_offset offset) const;
+
+        /**
+         * Return the compilation unit that contains the byte offset
+         * bytes into .debug_info, such as the offset of a DIE.  This
+         * binary searches the unit header offsets, and if this file
+         * uses lazy unit discovery, constructs only the unit found.
+         * If offset is outside .debug_info, throws out_of_range.
+         */
+        const compilation_unit &unit_containing(section_offset offset) const;
+
+        /**
+         * Return the type unit with the given signature.  The first
+         * call scans the type unit headers in .debug_types to index
+         * their signatures; each unit is constructed when it is
+         * first requested.  This is safe to call from several
+         * threads at once.  If the signature does not correspond to
+         * a type unit, throws out_of_range.
+         */
         const type_unit &get_type_unit(uint64_t type_signature) const;
 
+        /**
+         * Return the index mapping addresses to compilation units.
+         * This is constructed the first time it is requested and
+         * reused after that.  The index is built from .debug_aranges
+         * where possible.  Compilation units that .debug_aranges
+         * does not mention (or all of them, if the section is
+         * missing) are indexed using the address ranges of their
+         * root DIEs.  This does not check the ranges .debug_aranges
+         * gives for the units it does mention; to index a file whose
+         * .debug_aranges may be wrong, merge an index from
+         * address_index::from_units into one from
+         * address_index::from_aranges.
+         */
+        const address_index &get_address_index() const;
+
         /**
          * \internal Retrieve the specified section from this file.
          * If the section does not exist, throws format_error.
          */
         std::shared_ptr<section> get_section(section_type type) const;
 
+        /**
+         * \internal Return the abbrev table that begins offset bytes
+         * into .debug_abbrev, compiled for units whose data is
+         * unit_data.  Each table is parsed once for each unit format
+         * and shared by all units that use it.
+         */
+        std::shared_ptr<const abbrev_table>
+        get_abbrev_table(section_offset offset,
+                         const std::shared_ptr<section> &unit_data) const;
+
 private:
         struct impl;
         std::shared_ptr<impl> m;
@@ -247,6 +337,45 @@ public:
          */
         const abbrev_entry &get_abbrev(std::uint64_t acode) const;
 
+        /**
+         * Build a flattened index of this unit's DIE tree, if it
+         * hasn't been built already.  The index records the parent,
+         * next sibling, and depth of every DIE in the unit in a
+         * single linear pass.  Once it is built, advancing a
+         * die::iterator past a DIE with children takes constant
+         * time, rather than requiring a walk of the DIE's whole
+         * subtree.  die::parent, die::depth, die_count, and die_at
+         * build the index on demand.  This is not thread-safe with
+         * respect to other operations on this unit.
+         */
+        void enable_die_index() const;
+
+        /**
+         * Return the number of DIEs in this unit, not counting
+         * sibling list terminators.  This builds the DIE index.
+         */
+        size_t die_count() const;
+
+        /**
+         * Return the index'th DIE of this unit in depth-first order,
+         * where the root DIE has index 0.  This builds the DIE
+         * index.  Throws out_of_range if index >= die_count().
+         */
+        die die_at(size_t index) const;
+
+        /**
+         * \internal Return this unit's DIE index, or nullptr if it
+         * has not been built.
+         */
+        const die_index *get_die_index() const;
+
+        /**
+         * \internal Return the materialized PC range of DIE d in
+         * this unit, computing it on first use and caching it by
+         * the DIE's offset.  See die_cached_pc_range.
+         */
+        rangelist cached_pc_range(const die &d) const;
+
 protected:
         friend struct ::std::hash<unit>;
         struct impl;
@@ -339,7 +468,7 @@ class die
 public:
         DW_TAG tag;
 
-        die() : cu(nullptr), abbrev(nullptr) { }
+        die() : cu(nullptr), abbrev(nullptr), index(~0) { }
         die(const die &o) = default;
         die(die &&o) = default;
 
@@ -416,6 +545,32 @@ public:
          */
         const std::vector<std::pair<DW_AT, value> > attributes() const;
 
+        class attribute_iterator;
+        class attribute_range;
+
+        /**
+         * Return a range over the attributes of this DIE that yields
+         * (DW_AT, value) pairs.  Unlike attributes, this does not
+         * allocate; each value is constructed as the range is
+         * iterated.  The range refers to this DIE object, so it must
+         * not outlive it.
+         */
+        attribute_range each_attribute() const;
+
+        /**
+         * Return the parent of this DIE, or an invalid DIE if this
+         * is its unit's root DIE.  This builds the unit's DIE index
+         * if necessary, after which it takes constant time.
+         */
+        die parent() const;
+
+        /**
+         * Return the depth of this DIE in its unit's DIE tree, where
+         * the root DIE has depth 0.  Like parent, this uses the
+         * unit's DIE index.
+         */
+        unsigned depth() const;
+
         bool operator==(const die &o) const;
         bool operator!=(const die &o) const;
 
@@ -423,6 +578,7 @@ private:
         friend class unit;
         friend class type_unit;
         friend class value;
+        friend class die_ref;
         // XXX If we can get the CU, we don't need this
         friend struct ::std::hash<die>;
 
@@ -440,9 +596,19 @@ private:
         // The offset of the next DIE, relative to cu'd subsection.
         // This is set even for sibling list terminators.
         section_offset next;
+        // The position of this DIE in cu's DIE index, if known, or
+        // ~0 if not.  This saves searching the index for DIEs that
+        // were reached through it.
+        std::uint32_t index;
 
         die(const unit *cu);
 
+        /**
+         * Return the position of this DIE in cu's DIE index, building
+         * the index if necessary.
+         */
+        std::uint32_t get_index() const;
+
         /**
          * Read this DIE from the given offset in cu.
          */
@@ -509,6 +675,173 @@ die::end() const
         return iterator();
 }
 
+/**
+ * An iterator over the attributes of a DIE.  See die::each_attribute.
+ */
+class die::attribute_iterator
+{
+public:
+        attribute_iterator() : d(nullptr), index(0) { }
+
+        /**
+         * Return the index'th attribute of the DIE.  This constructs
+         * a new value, so the result should be bound by value.
+         */
+        std::pair<DW_AT, value> operator*() const;
+
+        attribute_iterator &operator++()
+        {
+                ++index;
+                return *this;
+        }
+
+        bool operator==(const attribute_iterator &o) const
+        {
+                return d == o.d && index == o.index;
+        }
+
+        bool operator!=(const attribute_iterator &o) const
+        {
+                return !(*this == o);
+        }
+
+private:
+        friend class die;
+
+        attribute_iterator(const die *d, size_t index)
+                : d(d), index(index) { }
+
+        const die *d;
+        size_t index;
+};
+
+/**
+ * A range over the attributes of a DIE.  See die::each_attribute.
+ */
+class die::attribute_range
+{
+public:
+        attribute_iterator begin() const
+        {
+                return b;
+        }
+
+        attribute_iterator end() const
+        {
+                return e;
+        }
+
+        /**
+         * Return the number of attributes in this range.
+         */
+        size_t size() const
+        {
+                return e.index - b.index;
+        }
+
+private:
+        friend class die;
+
+        attribute_range(attribute_iterator b, attribute_iterator e)
+                : b(b), e(e) { }
+
+        attribute_iterator b, e;
+};
+
+/**
+ * A lightweight reference to a DIE, consisting of just its unit and
+ * its offset in that unit.  Unlike a die, this is small and
+ * trivially copyable and has hashing and ordering, so it is suitable
+ * for storing large numbers of DIEs in maps and caches.  The full DIE
+ * can be retrieved with get.
+ *
+ * Like a die, a die_ref points to its unit object, so the caller is
+ * responsible for keeping the unit object live as long as the
+ * die_ref may be used.
+ */
+class die_ref
+{
+public:
+        /**
+         * Construct an invalid DIE reference.
+         */
+        die_ref() : cu(nullptr), offset(0) { }
+
+        /**
+         * Construct a reference to the DIE at the given offset in
+         * cu.
+         */
+        die_ref(const unit *cu, section_offset offset)
+                : cu(cu), offset(offset) { }
+
+        /**
+         * Construct a reference to d.  If d is not valid, this is
+         * equal to die_ref().
+         */
+        explicit die_ref(const die &d)
+                : cu(d.valid() ? &d.get_unit() : nullptr),
+                  offset(d.valid() ? d.get_unit_offset() : 0) { }
+
+        /**
+         * Return true if this refers to a DIE.  Default constructed
+         * references are not valid.
+         */
+        bool valid() const
+        {
+                return cu != nullptr;
+        }
+
+        /**
+         * Return the unit containing the referenced DIE.
+         */
+        const unit &get_unit() const
+        {
+                return *cu;
+        }
+
+        /**
+         * Return the referenced DIE's byte offset within its unit.
+         */
+        section_offset get_unit_offset() const
+        {
+                return offset;
+        }
+
+        /**
+         * Read and return the referenced DIE.  If this reference is
+         * not valid, returns an invalid DIE.
+         */
+        die get() const;
+
+        bool operator==(const die_ref &o) const
+        {
+                return cu == o.cu && offset == o.offset;
+        }
+
+        bool operator!=(const die_ref &o) const
+        {
+                return !(*this == o);
+        }
+
+        /**
+         * Order references by unit object, then by offset.  The
+         * order of DIEs in different units is arbitrary, but
+         * consistent for the life of the unit objects.
+         */
+        bool operator<(const die_ref &o) const
+        {
+                if (cu != o.cu)
+                        return std::less<const unit*>()(cu, o.cu);
+                return offset < o.offset;
+        }
+
+private:
+        friend struct ::std::hash<die_ref>;
+
+        const unit *cu;
+        section_offset offset;
+};
+
 /**
  * An exception indicating that a value is not of the requested type.
  */
@@ -928,7 +1261,7 @@ public:
         /**
          * Construct an empty range list.
          */
-        rangelist() = default;
+        rangelist() : base_addr(0), sorted(false) { }
 
         /** Copy constructor */
         rangelist(const rangelist &o) = default;
@@ -959,13 +1292,33 @@ public:
 
         /**
          * Return true if this range list contains the given address.
+         * This takes time logarithmic in the number of ranges for a
+         * materialized range list and linear time otherwise.
          */
         bool contains(taddr addr) const;
 
+        /**
+         * Return a copy of this range list decoded into memory, with
+         * its ranges sorted by address and overlapping, adjacent,
+         * and empty ranges merged away.  Iterating over the result
+         * yields disjoint ranges in increasing order, and contains
+         * does a binary search rather than decoding the list.  This
+         * is worthwhile for lists that will be searched repeatedly,
+         * such as those of functions split into many pieces.
+         */
+        rangelist materialize() const;
+
 private:
-        std::vector<taddr> synthetic;
+        void set_synthetic();
+
+        // Range data held in memory, as {low, high} pairs ending with
+        // {0, 0}.  This is shared between copies, since sec points
+        // into it.
+        std::shared_ptr<std::vector<taddr> > synthetic;
         std::shared_ptr<section> sec;
         taddr base_addr;
+        // True if synthetic holds disjoint ranges in increasing order
+        bool sorted;
 };
 
 /**
@@ -1052,6 +1405,118 @@ private:
         rangelist::entry entry;
 };
 
+//////////////////////////////////////////////////////////////////
+// Address indexes
+//
+
+/**
+ * An index from target addresses to the compilation units whose code
+ * covers them.  The index is a sorted table of disjoint address
+ * ranges, so finding the compilation unit for an address takes time
+ * logarithmic in the number of ranges.  This class is internally
+ * reference counted and can be efficiently copied.
+ */
+class address_index
+{
+public:
+        /**
+         * A range of addresses [low, high) covered by the
+         * compilation unit whose header is cu_offset bytes into
+         * .debug_info.
+         */
+        struct range
+        {
+                taddr low, high;
+                section_offset cu_offset;
+        };
+
+        /**
+         * Construct an address index from the .debug_aranges section
+         * of file.  Where the table lists overlapping ranges, the
+         * overlap is attributed to the range with the lowest
+         * starting address.  Throws format_error if the section is
+         * missing or malformed.
+         */
+        static address_index from_aranges(const dwarf &file);
+
+        /**
+         * Construct an address index from the DW_AT::low_pc,
+         * DW_AT::high_pc, and DW_AT::ranges attributes of the root
+         * DIE of every compilation unit in file.  This does not
+         * depend on .debug_aranges, but must read every compilation
+         * unit's root DIE, so the work is spread across a pool of
+         * nthreads threads.  If nthreads is 0, this uses one thread
+         * per hardware thread.  Overlapping ranges are resolved as
+         * for from_aranges and recorded in overlaps().
+         */
+        static address_index from_units(const dwarf &file,
+                                        unsigned nthreads = 0);
+
+        /**
+         * Combine two indexes of the same file.  Addresses covered
+         * by primary are attributed as primary says.  Addresses
+         * covered only by fallback fill gaps in primary and are
+         * recorded in gaps().  Ranges of fallback that primary
+         * attributes to a different compilation unit are recorded
+         * in overlaps().
+         */
+        static address_index merge(const address_index &primary,
+                                   const address_index &fallback);
+
+        /**
+         * Return primary merged with an index built as in from_units
+         * from just those compilation units of file that primary
+         * does not mention at all.  This is cheap if primary is
+         * already complete: if file uses lazy unit discovery, only
+         * the missing units are constructed.
+         */
+        static address_index fill_missing_units(const address_index &primary,
+                                                const dwarf &file,
+                                                unsigned nthreads = 0);
+
+        /**
+         * Construct an empty address index.
+         */
+        address_index() = default;
+
+        address_index(const address_index &o) = default;
+        address_index(address_index &&o) = default;
+
+        address_index& operator=(const address_index &o) = default;
+        address_index& operator=(address_index &&o) = default;
+
+        /**
+         * Find the compilation unit covering addr.  If there is one,
+         * set *cu_offset_out to the .debug_info offset of its header
+         * and return true.  Otherwise, return false.
+         */
+        bool find(taddr addr, section_offset *cu_offset_out) const;
+
+        /**
+         * Return the ranges in this index, sorted by address.
+         */
+        const std::vector<range> &ranges() const;
+
+        /**
+         * Return the ranges that were claimed by more than one
+         * compilation unit while constructing this index, sorted by
+         * address.  The cu_offset of each range is the compilation
+         * unit whose claim was discarded.
+         */
+        const std::vector<range> &overlaps() const;
+
+        /**
+         * Return the ranges that were missing from the primary index
+         * and filled in from the fallback index by merge, sorted by
+         * address.
+         */
+        const std::vector<range> &gaps() const;
+
+private:
+        struct impl;
+        std::shared_ptr<impl> m;
+};
+
 //////////////////////////////////////////////////////////////////
 // Line number tables
 //
@@ -1130,6 +1595,19 @@ public:
          */
         iterator find_address(taddr addr) const;
 
+        /**
+         * Make find_address use an address index for this line
+         * table.  The index is built the first time find_address is
+         * called after this, by decoding the whole line number
+         * program once, grouping its rows by sequence, and sorting
+         * the sequences by starting address.  After that,
+         * find_address is a binary search.  The index is shared by
+         * all copies of this line table, so it is reused across
+         * calls.  Without this, each find_address call decodes the
+         * line number program from the beginning.
+         */
+        void enable_address_index() const;
+
         /**
          * Return the index'th file in the line table.  These indexes
          * are typically used by declaration and call coordinates.  If
@@ -1139,6 +1617,7 @@ public:
 
 private:
         friend class iterator;
+        friend class compact_line_table;
 
         struct impl;
         std::shared_ptr<impl> m;
@@ -1336,10 +1815,21 @@ public:
         }
 
 private:
+        friend class line_table;
+        friend class compact_line_table;
+
         const line_table *table;
         line_table::entry entry, regs;
         section_offset pos;
 
+        /**
+         * Construct an iterator for the given line table positioned
+         * at row, which was emitted by the opcode ending just before
+         * pos.
+         */
+        iterator(const line_table *table, section_offset pos,
+                 const line_table::entry &row);
+
         /**
          * Process the next opcode.  If the opcode "adds a row to the
          * table", update entry to reflect the row and return true.
@@ -1347,6 +1837,533 @@ private:
         bool step(cursor *cur);
 };
 
+/**
+ * A fully decoded line table in a compact form.  Rather than a
+ * line_table::entry per row, this stores each field in a separate
+ * array: addresses as 32-bit offsets from a per-block base address,
+ * line, column and file index packed into one word, and the boolean
+ * fields as bitsets.  Rarely used fields are stored sparsely.  This
+ * takes several times less memory than a vector of entries and
+ * gives constant time random access to rows, so it is suitable for
+ * caching the line tables of many compilation units.
+ *
+ * Unlike iterating over a line_table, this includes the final
+ * end_sequence row of the table.  This class is internally reference
+ * counted and can be efficiently copied.
+ */
+class compact_line_table
+{
+public:
+        /**
+         * Decode all of the rows of table.
+         */
+        explicit compact_line_table(const line_table &table);
+
+        /**
+         * Construct an invalid, empty compact line table.
+         */
+        compact_line_table() = default;
+
+        compact_line_table(const compact_line_table &o) = default;
+        compact_line_table(compact_line_table &&o) = default;
+
+        compact_line_table &operator=(const compact_line_table &o) = default;
+        compact_line_table &operator=(compact_line_table &&o) = default;
+
+        /**
+         * Return true if this object represents a decoded line
+         * table.  Default constructed objects are not valid.
+         */
+        bool valid() const
+        {
+                return !!m;
+        }
+
+        /**
+         * Return the number of rows in this table.
+         */
+        size_t size() const;
+
+        /**
+         * Return the index'th row of this table.  The file field of
+         * the returned entry points into the line table this was
+         * decoded from.
+         */
+        line_table::entry operator[](size_t index) const;
+
+        /**
+         * Return the address of the index'th row.  This is cheaper
+         * than retrieving the whole row.
+         */
+        taddr address(size_t index) const;
+
+        /**
+         * Return true if the index'th row ends a sequence.
+         */
+        bool end_sequence(size_t index) const;
+
+        /**
+         * Return the line table this was decoded from.
+         */
+        const line_table &get_line_table() const;
+
+        /**
+         * Return the approximate number of bytes of memory used by
+         * this table's rows.
+         */
+        size_t memory_usage() const;
+
+private:
+        friend class line_table;
+
+        struct impl;
+        std::shared_ptr<impl> m;
+};
+
+/**
+ * An index from source lines to the addresses of the code generated
+ * for them, across any number of compilation units.  This is the
+ * inverse of line_table::find_address and is useful for setting
+ * breakpoints on a source line or for attributing coverage.
+ *
+ * Source file paths are interned, so looking up a line takes
+ * constant expected time regardless of the number of compilation
+ * units in the index.  Compilation units can be added incrementally
+ * as they are needed.  This class is internally reference counted;
+ * copies share the same underlying index, including units added
+ * after the copy was made.
+ */
+class line_index
+{
+public:
+        /**
+         * A range of addresses [low, high) generated for a source
+         * line by the compilation unit whose header is cu_offset
+         * bytes into .debug_info.
+         */
+        struct range
+        {
+                taddr low, high;
+                section_offset cu_offset;
+        };
+
+        /**
+         * Construct an index of the line tables of every compilation
+         * unit in file.  The line tables are decoded in parallel by
+         * nthreads threads; if nthreads is 0, this uses one thread
+         * per hardware thread.
+         */
+        static line_index from_units(const dwarf &file,
+                                     unsigned nthreads = 0);
+
+        /**
+         * Construct an empty line index.
+         */
+        line_index();
+
+        line_index(const line_index &o) = default;
+        line_index(line_index &&o) = default;
+
+        line_index& operator=(const line_index &o) = default;
+        line_index& operator=(line_index &&o) = default;
+
+        /**
+         * Add the line table of cu to this index.  Adding a
+         * compilation unit that is already in the index has no
+         * effect.  This is not thread-safe with respect to other
+         * operations on this index.
+         */
+        void add_unit(const compilation_unit &cu);
+
+        /**
+         * Add the line tables of units to this index, decoding them
+         * in parallel with nthreads threads as for from_units.  If
+         * decoding any line table fails, this throws and none of
+         * units are marked as added, so they may be added again.
+         */
+        void add_units(const std::vector<const compilation_unit*> &units,
+                       unsigned nthreads = 0);
+
+        /**
+         * Return the address ranges generated for line of the source
+         * file path, sorted by address.  path must exactly match the
+         * path of a file in a line table.  Adjacent ranges from the
+         * same compilation unit are coalesced.  If there is no code
+         * for the line, this returns an empty vector.
+         */
+        const std::vector<range> &find(const std::string &path,
+                                       unsigned line) const;
+
+        /**
+         * Return the paths of all source files that have code in
+         * this index, in no particular order.
+         */
+        const std::vector<std::string> &files() const;
+
+private:
+        struct impl;
+        std::shared_ptr<impl> m;
+};
+
+//////////////////////////////////////////////////////////////////
+// Function indexes
+//
+
+/**
+ * An index from addresses to the functions of one compilation unit
+ * whose code covers them, including inlined instances.  The
+ * subprogram and inlined_subroutine DIEs of the unit are read once
+ * when the index is constructed and their ranges are flattened into
+ * a sorted table of disjoint intervals, each labeled with the
+ * innermost DIE that covers it.  Finding the inline chain for an
+ * address is a binary search followed by a walk to the outermost
+ * function, so it takes time logarithmic in the number of intervals
+ * plus the inlining depth.  This class is internally reference
+ * counted and can be efficiently copied.  The index refers to the
+ * compilation unit it was built from, so the caller must keep that
+ * unit live.
+ */
+class function_index
+{
+public:
+        /**
+         * A function containing an address.  function is a
+         * subprogram DIE or, for an inlined instance, an
+         * inlined_subroutine DIE.  For inlined instances, call_file,
+         * call_line, and call_column give the location of the call
+         * in the enclosing function (DW_AT::call_file and so on).
+         * call_file is nullptr and the others are 0 where that is
+         * unknown.  call_file points into the unit's line table.
+         */
+        struct frame
+        {
+                die_ref function;
+                const line_table::file *call_file;
+                unsigned call_line, call_column;
+        };
+
+        /**
+         * Construct an index of the functions in cu.  DIEs whose
+         * ranges can't be read are skipped.  The ranges of an
+         * inlined instance that extend outside the DIE enclosing it
+         * are clipped to the enclosing DIE's ranges.
+         */
+        explicit function_index(const compilation_unit &cu);
+
+        /**
+         * Construct an empty function index.
+         */
+        function_index() = default;
+
+        function_index(const function_index &o) = default;
+        function_index(function_index &&o) = default;
+
+        function_index& operator=(const function_index &o) = default;
+        function_index& operator=(function_index &&o) = default;
+
+        /**
+         * Find the functions whose code covers pc and store them in
+         * *frames, innermost first.  The first frame is the most
+         * deeply inlined instance and the last is the subprogram it
+         * was ultimately inlined into.  Returns false and clears
+         * *frames if no function covers pc.
+         */
+        bool find(taddr pc, std::vector<frame> *frames) const;
+
+        /**
+         * Return the number of disjoint intervals in this index.
+         */
+        size_t size() const;
+
+private:
+        struct impl;
+        std::shared_ptr<impl> m;
+};
+
+//////////////////////////////////////////////////////////////////
+// Symbolization
+//
+
+/**
+ * What symbolize found for an address.
+ */
+struct symbolized_pc
+{
+        /**
+         * The compilation unit whose code covers pc, or nullptr if
+         * none does.  If this is nullptr, the other fields are
+         * empty.
+         */
+        const compilation_unit *cu;
+
+        /**
+         * The source location of pc from cu's line table.  file is
+         * nullptr and line and column are 0 if the line table does
+         * not cover pc.  file points into cu's line table.
+         */
+        const line_table::file *file;
+        unsigned line, column;
+
+        /**
+         * The functions containing pc, innermost first, as returned
+         * by function_index::find.  The last frame is the subprogram
+         * containing pc and the others are the instances inlined
+         * into it.  This is empty if no function covers pc.
+         */
+        std::vector<function_index::frame> frames;
+};
+
+/**
+ * Symbolize the count addresses in pcs, storing the result for
+ * pcs[i] in (*out)[i].  This is much faster than looking up each
+ * address separately when there are many addresses: the addresses
+ * are sorted and deduplicated, grouped by the compilation unit that
+ * covers them (found with file.get_address_index()), and each unit's
+ * line table and function_index are decoded once for its whole
+ * group.  Groups are processed in parallel by up to nthreads
+ * threads, or one thread per hardware thread if nthreads is 0, and
+ * each unit is used by one thread at a time.  If a unit's line
+ * table or function DIEs are malformed, the results for the
+ * addresses in that unit have cu set but no location or frames,
+ * rather than the error aborting the whole batch.  This is not
+ * thread-safe with respect to other operations on the units of
+ * file.
+ */
+void symbolize(const dwarf &file, const taddr *pcs, size_t count,
+               std::vector<symbolized_pc> *out, unsigned nthreads = 0);
+
+//////////////////////////////////////////////////////////////////
+// Name indexes
+//
+
+/**
+ * An index from names to the DIEs that define them, read from one
+ * of the name lookup tables a compiler may emit alongside
+ * .debug_info or built from the units themselves.  Looking up a
+ * name takes constant expected time and does not read any
+ * compilation units, unlike searching each unit with a
+ * die_str_map.  This class is internally reference counted and can
+ * be efficiently copied.
+ */
+class name_index
+{
+public:
+        /**
+         * A DIE named in the index.  Both offsets are relative to
+         * the beginning of .debug_info: cu_offset is the offset of
+         * the header of the unit containing the DIE and die_offset
+         * is the offset of the DIE itself.
+         */
+        struct entry
+        {
+                section_offset cu_offset, die_offset;
+
+                /**
+                 * Return the DIE this entry refers to.  This
+                 * constructs only the compilation unit containing
+                 * the DIE, which is found from die_offset.  Throws
+                 * out_of_range if die_offset is outside
+                 * .debug_info.
+                 */
+                die get(const dwarf &file) const;
+        };
+
+        /**
+         * Construct a name index from the .debug_pubnames section of
+         * file, which names global functions and objects.  Throws
+         * format_error if the section is missing or malformed.
+         */
+        static name_index from_pubnames(const dwarf &file);
+
+        /**
+         * Construct a name index from the .debug_pubtypes section of
+         * file, which names global types.  Throws format_error if the
+         * section is missing or malformed.
+         */
+        static name_index from_pubtypes(const dwarf &file);
+
+        /**
+         * Construct a name index from the DWARF 5 .debug_names
+         * section of file.  Lookups probe the section's hash table
+         * in place and compare names directly against .debug_str,
+         * so constructing the index only reads the section headers.
+         * Entries for type units that are not in this file (foreign
+         * type units) are omitted.  Throws format_error if the
+         * section is missing or malformed.
+         */
+        static name_index from_debug_names(const dwarf &file);
+
+        /**
+         * Construct a name index by reading every compilation unit
+         * of file, for files that have no name lookup tables.  The
+         * index names functions (including inlined instances),
+         * variables with static storage, and named types, under
+         * their plain names (such as "f"), their qualified names
+         * (such as "ns::type::f"), and their linkage names.  Names
+         * local to a function are indexed only under their plain
+         * names.  Units are read concurrently by up to nthreads
+         * threads, or one thread per hardware thread if nthreads is
+         * 0.  Unlike the other indexes, this does not depend on
+         * file once constructed, and it is safe to query from many
+         * threads at once.
+         */
+        static name_index from_units(const dwarf &file, unsigned nthreads = 0);
+
+        /**
+         * Construct an empty name index.
+         */
+        name_index() = default;
+
+        name_index(const name_index &o) = default;
+        name_index(name_index &&o) = default;
+
+        name_index& operator=(const name_index &o) = default;
+        name_index& operator=(name_index &&o) = default;
+
+        /**
+         * Return the DIEs named name, in the order they appear in
+         * the index.  A name may be defined by more than one
+         * compilation unit.  Entries the index repeats back to back
+         * are only returned once.  If no DIE has this name, this
+         * returns an empty vector.  Throws format_error if the
+         * index entries for name are malformed.
+         */
+        std::vector<entry> find(const std::string &name) const;
+
+        /**
+         * Return the number of names in this index.  An index read
+         * from several name tables, such as a .debug_names section
+         * with one table per compilation unit, counts a name once
+         * for each table that lists it.
+         */
+        size_t size() const;
+
+private:
+        struct impl;
+        std::shared_ptr<impl> m;
+};
+
+//////////////////////////////////////////////////////////////////
+// GDB indexes
+//
+
+/**
+ * A reader for the .gdb_index section that GDB and some linkers (for
+ * example, with --gdb-index) attach to a file.  The section maps
+ * address ranges and symbol names to the units that define them.
+ * Lookups read the section in place, so the index is ready as soon
+ * as it is constructed and does not read any units.  This supports
+ * index versions 7 through 9.  This class is internally reference
+ * counted and can be efficiently copied.
+ */
+class gdb_index
+{
+public:
+        /**
+         * The kind of a symbol in the index.
+         */
+        enum class symbol_kind
+        {
+                none = 0,
+                type = 1,
+                variable = 2,
+                function = 3,
+                other = 4,
+        };
+
+        /**
+         * A unit defining a symbol.  If type_unit is false,
+         * unit_offset is the offset of a compilation unit header in
+         * .debug_info.  If it is true, unit_offset is the offset of a
+         * type unit header in .debug_types.
+         */
+        struct symbol
+        {
+                section_offset unit_offset;
+                bool type_unit;
+                symbol_kind kind;
+                // True if the symbol is static (local to the unit).
+                bool is_static;
+        };
+
+        /**
+         * Construct a reader for the .gdb_index section of file.
+         * Throws format_error if the section is missing, malformed,
+         * or of an unsupported version.
+         */
+        explicit gdb_index(const dwarf &file);
+
+        gdb_index() = default;
+        gdb_index(const gdb_index &o) = default;
+        gdb_index(gdb_index &&o) = default;
+
+        gdb_index& operator=(const gdb_index &o) = default;
+        gdb_index& operator=(gdb_index &&o) = default;
+
+        /**
+         * Return the version of this index.
+         */
+        unsigned version() const;
+
+        /**
+         * Find the compilation unit covering addr.  If there is one,
+         * set *cu_offset_out to the .debug_info offset of its header
+         * and return true.  Otherwise, return false.  This takes time
+         * logarithmic in the size of the index's address table.
+         */
+        bool find_address(taddr addr, section_offset *cu_offset_out) const;
+
+        /**
+         * Return the units defining name, in the order the index
+         * lists them.  If no unit defines name, this returns an
+         * empty vector.  This takes constant expected time.
+         */
+        std::vector<symbol> find(const std::string &name) const;
+
+private:
+        struct impl;
+        std::shared_ptr<impl> m;
+};
+
+std::string
+to_string(gdb_index::symbol_kind v);
+
+//////////////////////////////////////////////////////////////////
+// Index generation
+//
+
+/**
+ * Build a DWARF 5 .debug_names section indexing every compilation
+ * unit of file, for files that were built without one.  The units are
+ * read in parallel by nthreads threads; if nthreads is 0, this uses
+ * one thread per hardware thread.  The index names functions
+ * (including inlined instances), variables with static storage, named
+ * types, labels, and namespaces, under both their names and linkage
+ * names.
+ *
+ * .debug_names refers to names by their offset in .debug_str.  If any
+ * name is not already in .debug_str, *str_out is set to a copy of
+ * .debug_str with the missing names appended, and .debug_str must be
+ * replaced with it when the new section is attached.  Otherwise,
+ * *str_out is left empty.  The result is in the file's byte order and
+ * can be attached to it with, for example, objcopy --add-section.
+ */
+std::vector<char>
+write_debug_names(const dwarf &file, std::vector<char> *str_out,
+                  unsigned nthreads = 0);
+
+/**
+ * Build a version 8 .gdb_index section indexing every compilation
+ * unit of file, for files that were linked without one.  This reads
+ * the units in parallel as for write_debug_names.  Symbols are
+ * indexed under their qualified names, such as "ns::type::f", and
+ * the address table comes from file.get_address_index().  As GDB
+ * does, this omits names local to functions and inlined instances.
+ * Type units are not indexed.
+ */
+std::vector<char>
+write_gdb_index(const dwarf &file, unsigned nthreads = 0);
+
 //////////////////////////////////////////////////////////////////
 // Type-safe attribute getters
 //
@@ -1425,6 +2442,15 @@ DW_VIS at_visibility(const die &d);
  */
 rangelist die_pc_range(const die &d);
 
+/**
+ * Return die_pc_range(d) materialized (see rangelist::materialize).
+ * The range is computed the first time it is requested for each DIE
+ * and cached in d's unit, so repeated contains tests against the
+ * same DIE only search the cached ranges.  The cache is locked, so
+ * this is safe to call from several threads at once.
+ */
+rangelist die_cached_pc_range(const die &d);
+
 //////////////////////////////////////////////////////////////////
 // Utilities
 //
@@ -1553,6 +2579,22 @@ namespace std
                 typedef const dwarf::die &argument_type;
                 result_type operator()(argument_type a) const;
         };
+
+        template<>
+        struct hash<dwarf::die_ref>
+        {
+                typedef size_t result_type;
+                typedef const dwarf::die_ref &argument_type;
+                result_type operator()(argument_type a) const
+                {
+                        // Units are far apart in memory and DIE
+                        // offsets are dense, so mix the offset to
+                        // spread nearby DIEs across buckets
+                        return hash<const dwarf::unit*>()(a.cu) ^
+                                (size_t)(a.get_unit_offset() *
+                                         0x9e3779b97f4a7c15ull);
+                }
+        };
 }
 
 #endif
@@ -4,6 +4,9 @@
 
 #include "internal.hh"
 
+#include <algorithm>
+#include <tuple>
+
 using namespace std;
 
 DWARFPP_BEGIN_NAMESPACE
@@ -15,22 +18,128 @@ DWARFPP_BEGIN_NAMESPACE
 struct dwarf::impl
 {
         impl(const std::shared_ptr<loader> &l)
-                : l(l), have_type_units(false) { }
+                : l(l), have_unit_offsets(false), have_all_units(false),
+                  have_type_unit_sigs(false), have_address_index(false) { }
 
         std::shared_ptr<loader> l;
 
         std::shared_ptr<section> sec_info;
         std::shared_ptr<section> sec_abbrev;
 
+        // The offsets of the compilation unit headers, in order.
+        // compilation_units is sized to match once these are known
+        // and never resized after that, so references to units
+        // remain stable.  Until a unit is needed, its entry is an
+        // invalid placeholder.
+        std::vector<section_offset> unit_offsets;
         std::vector<compilation_unit> compilation_units;
+        bool have_unit_offsets;
+        std::atomic<bool> have_all_units;
+
+        // The signatures of the type units in .debug_types and the
+        // offsets of their headers, sorted by signature.  As with
+        // compilation units, type_units is sized to match and its
+        // entries are constructed only when needed.
+        std::vector<std::pair<uint64_t, section_offset> > type_unit_sigs;
+        std::vector<type_unit> type_units;
+        bool have_type_unit_sigs;
 
-        std::unordered_map<uint64_t, type_unit> type_units;
-        bool have_type_units;
+        address_index addr_index;
+        bool have_address_index;
 
         std::map<section_type, std::shared_ptr<section> > sections;
+
+        // Parsed abbrev tables, indexed by .debug_abbrev offset,
+        // address size, and format
+        std::map<std::tuple<section_offset, unsigned, format>,
+                 std::shared_ptr<const abbrev_table> > abbrev_tables;
+
+        // Protects sections, addr_index, abbrev_tables, and the
+        // lazily constructed compilation and type units, which may
+        // be requested from several threads at once while building
+        // indexes in parallel.
+        std::mutex lock;
+
+        void find_unit_offsets();
+        void find_type_unit_sigs(const std::shared_ptr<section> &types);
+        const compilation_unit &get_unit(const dwarf &file, size_t index);
 };
 
-dwarf::dwarf(const std::shared_ptr<loader> &l)
+/**
+ * Scan the unit headers in .debug_info to find where each unit
+ * begins, if this hasn't been done already.  The caller must hold
+ * lock.
+ */
+void
+dwarf::impl::find_unit_offsets()
+{
+        if (have_unit_offsets)
+                return;
+        cursor infocur(sec_info);
+        while (!infocur.end()) {
+                unit_offsets.push_back(infocur.get_section_offset());
+                infocur.skip_subsection();
+        }
+        unit_offsets.shrink_to_fit();
+        compilation_units.resize(unit_offsets.size());
+        have_unit_offsets = true;
+}
+
+/**
+ * Scan the unit headers in .debug_types to find the signature of
+ * each type unit, if this hasn't been done already.  This reads only
+ * the headers, not the units' DIEs.  The caller must hold lock.
+ */
+void
+dwarf::impl::find_type_unit_sigs(const std::shared_ptr<section> &types)
+{
+        if (have_type_unit_sigs)
+                return;
+        cursor tucur(types);
+        while (!tucur.end()) {
+                // The signature follows the initial length, version,
+                // abbrev offset, and address size (DWARF4 section
+                // 7.5.1.2)
+                section_offset offset = tucur.get_section_offset();
+                format fmt;
+                section_length length = tucur.skip_subsection(&fmt);
+                section_length sig_pos = fmt == format::dwarf32 ?
+                        4 + 2 + 4 + 1 : 12 + 2 + 8 + 1;
+                if (length < sig_pos + sizeof(uint64_t))
+                        throw format_error("type unit at offset 0x" +
+                                           to_hex(offset) + " is truncated");
+                uint64_t sig = cursor(types, offset + sig_pos).fixed<uint64_t>();
+                type_unit_sigs.emplace_back(sig, offset);
+        }
+        // If two units have the same signature (which should be
+        // the same type), use the first
+        stable_sort(type_unit_sigs.begin(), type_unit_sigs.end(),
+                    [](const pair<uint64_t, section_offset> &a,
+                       const pair<uint64_t, section_offset> &b) {
+                            return a.first < b.first;
+                    });
+        type_unit_sigs.shrink_to_fit();
+        type_units.resize(type_unit_sigs.size());
+        have_type_unit_sigs = true;
+}
+
+/**
+ * Return the index'th compilation unit, constructing it if
+ * necessary.  The caller must hold lock.
+ */
+const compilation_unit &
+dwarf::impl::get_unit(const dwarf &file, size_t index)
+{
+        compilation_unit &cu = compilation_units[index];
+        if (!cu.valid())
+                // XXX Circular reference.  Given that we now require
+                // the dwarf object to stick around for DIEs, maybe we
+                // might as well require that for units, too.
+                cu = compilation_unit(file, unit_offsets[index]);
+        return cu;
+}
+
+dwarf::dwarf(const std::shared_ptr<loader> &l, unit_discovery discovery)
         : m(make_shared<impl>(l))
 {
         const void *data;
@@ -62,16 +171,10 @@ dwarf::dwarf(const std::shared_ptr<loader> &l)
         m->sec_abbrev = make_shared<section>(section_type::abbrev, data, size, m->sec_info->ord);
 
         // Get compilation units.  Everything derives from these, so
-        // there's no point in doing it lazily.
-        cursor infocur(m->sec_info);
-        while (!infocur.end()) {
-                // XXX Circular reference.  Given that we now require
-                // the dwarf object to stick around for DIEs, maybe we
-                // might as well require that for units, too.
-                m->compilation_units.emplace_back(
-                        *this, infocur.get_section_offset());
-                infocur.subsection();
-        }
+        // unless the caller asked otherwise, there's no point in
+        // doing it lazily.
+        if (discovery == unit_discovery::eager)
+                compilation_units();
 }
 
 dwarf::~dwarf()
@@ -84,25 +187,113 @@ dwarf::compilation_units() const
         static std::vector<compilation_unit> empty;
         if (!m)
                 return empty;
+        if (!m->have_all_units) {
+                lock_guard<mutex> guard(m->lock);
+                m->find_unit_offsets();
+                for (size_t i = 0; i < m->unit_offsets.size(); i++)
+                        m->get_unit(*this, i);
+                m->have_all_units = true;
+        }
         return m->compilation_units;
 }
 
+const std::vector<section_offset> &
+dwarf::compilation_unit_offsets() const
+{
+        static std::vector<section_offset> empty;
+        if (!m)
+                return empty;
+        // unit_offsets never changes once it has been filled in
+        lock_guard<mutex> guard(m->lock);
+        m->find_unit_offsets();
+        return m->unit_offsets;
+}
+
+const compilation_unit &
+dwarf::find_unit_by_offset(section_offset offset) const
+{
+        lock_guard<mutex> guard(m->lock);
+        m->find_unit_offsets();
+        auto it = lower_bound(m->unit_offsets.begin(), m->unit_offsets.end(),
+                              offset);
+        if (it == m->unit_offsets.end() || *it != offset)
+                throw out_of_range("no compilation unit at offset 0x" +
+                                   to_hex(offset));
+        return m->get_unit(*this, it - m->unit_offsets.begin());
+}
+
+const compilation_unit &
+dwarf::unit_containing(section_offset offset) const
+{
+        lock_guard<mutex> guard(m->lock);
+        m->find_unit_offsets();
+        // Units are contiguous, so the unit containing offset is
+        // the last one that begins at or before it
+        auto it = upper_bound(m->unit_offsets.begin(), m->unit_offsets.end(),
+                              offset);
+        if (it == m->unit_offsets.begin() ||
+            offset >= (section_offset)(m->sec_info->end - m->sec_info->begin))
+                throw out_of_range("no compilation unit contains offset 0x" +
+                                   to_hex(offset));
+        return m->get_unit(*this, it - m->unit_offsets.begin() - 1);
+}
+
 const type_unit &
 dwarf::get_type_unit(uint64_t type_signature) const
 {
-        if (!m->have_type_units) {
-                cursor tucur(get_section(section_type::types));
-                while (!tucur.end()) {
-                        // XXX Circular reference
-                        type_unit tu(*this, tucur.get_section_offset());
-                        m->type_units[tu.get_type_signature()] = tu;
-                        tucur.subsection();
-                }
-                m->have_type_units = true;
+        shared_ptr<section> types = get_section(section_type::types);
+        size_t index;
+        {
+                lock_guard<mutex> guard(m->lock);
+                m->find_type_unit_sigs(types);
+                auto &sigs = m->type_unit_sigs;
+                auto it = lower_bound(sigs.begin(), sigs.end(),
+                                      make_pair(type_signature, (section_offset)0));
+                if (it == sigs.end() || it->first != type_signature)
+                        throw out_of_range("type signature 0x" +
+                                           to_hex(type_signature));
+                index = it - sigs.begin();
+                if (m->type_units[index].valid())
+                        return m->type_units[index];
+        }
+
+        // Construct the unit without holding the lock, since that
+        // needs .debug_types.  If another thread constructs the same
+        // unit at the same time, the first one to finish wins.
+        // XXX Circular reference
+        type_unit tu(*this, m->type_unit_sigs[index].second);
+
+        lock_guard<mutex> guard(m->lock);
+        type_unit &res = m->type_units[index];
+        if (!res.valid())
+                res = move(tu);
+        return res;
+}
+
+const address_index &
+dwarf::get_address_index() const
+{
+        // Don't hold the lock while building the index, since that
+        // needs to load other sections.
+        {
+                lock_guard<mutex> guard(m->lock);
+                if (m->have_address_index)
+                        return m->addr_index;
+        }
+
+        address_index aranges;
+        size_t size;
+        if (m->l->load(section_type::aranges, &size))
+                aranges = address_index::from_aranges(*this);
+        address_index index =
+                address_index::fill_missing_units(aranges, *this);
+
+        lock_guard<mutex> guard(m->lock);
+        if (!m->have_address_index) {
+                m->addr_index = move(index);
+                m->have_address_index = true;
         }
-        if (!m->type_units.count(type_signature))
-                throw out_of_range("type signature 0x" + to_hex(type_signature));
-        return m->type_units[type_signature];
+        return m->addr_index;
 }
 
 std::shared_ptr<section>
@@ -113,6 +304,7 @@ dwarf::get_section(section_type type) const
         if (type == section_type::abbrev)
                 return m->sec_abbrev;
 
+        lock_guard<mutex> guard(m->lock);
         auto it = m->sections.find(type);
         if (it != m->sections.end())
                 return it->second;
@@ -126,6 +318,29 @@ dwarf::get_section(section_type type) const
         return m->sections[type];
 }
 
+std::shared_ptr<const abbrev_table>
+dwarf::get_abbrev_table(section_offset offset,
+                        const std::shared_ptr<section> &unit_data) const
+{
+        auto key = make_tuple(offset, unit_data->addr_size, unit_data->fmt);
+        {
+                lock_guard<mutex> guard(m->lock);
+                auto it = m->abbrev_tables.find(key);
+                if (it != m->abbrev_tables.end())
+                        return it->second;
+        }
+
+        // Parse the table without holding the lock.  If another
+        // thread parses the same table at the same time, the first
+        // one to finish wins.
+        auto table = make_shared<abbrev_table>(cursor(m->sec_abbrev, offset),
+                                               unit_data->addr_size,
+                                               unit_data->fmt);
+
+        lock_guard<mutex> guard(m->lock);
+        return m->abbrev_tables.emplace(key, move(table)).first->second;
+}
+
 //////////////////////////////////////////////////////////////////
 // class unit
 //
@@ -151,12 +366,17 @@ struct unit::impl
         // Lazily constructed line table
         line_table lt;
 
-        // Map from abbrev code to abbrev.  If the map is dense, it
-        // will be stored in the vector; otherwise it will be stored
-        // in the map.
-        bool have_abbrevs;
-        std::vector<abbrev_entry> abbrevs_vec;
-        std::unordered_map<abbrev_code, abbrev_entry> abbrevs_map;
+        // Lazily retrieved abbrev table, shared with other units
+        std::shared_ptr<const abbrev_table> abbrevs;
+
+        // Lazily constructed DIE index
+        std::shared_ptr<die_index> dies;
+
+        // Materialized PC ranges of DIEs, by unit offset, and the
+        // lock that protects them.  Entries are never removed or
+        // replaced.
+        std::unordered_map<section_offset, rangelist> pc_ranges;
+        std::mutex pc_ranges_lock;
 
         impl(const dwarf &file, section_offset offset,
              const std::shared_ptr<section> &subsec,
@@ -165,7 +385,7 @@ struct unit::impl
                 : file(file), offset(offset), subsec(subsec),
                   debug_abbrev_offset(debug_abbrev_offset),
                   root_offset(root_offset), type_signature(type_signature),
-                  type_offset(type_offset), have_abbrevs(false) { }
+                  type_offset(type_offset) { }
 
         void force_abbrevs();
 };
@@ -206,59 +426,68 @@ unit::data() const
 const abbrev_entry &
 unit::get_abbrev(abbrev_code acode) const
 {
-        if (!m->have_abbrevs)
-                m->force_abbrevs();
+        m->force_abbrevs();
+        const abbrev_entry *entry = m->abbrevs->find(acode);
+        if (!entry)
+                throw format_error("unknown abbrev code 0x" + to_hex(acode));
+        return *entry;
+}
 
-        if (!m->abbrevs_vec.empty()) {
-                if (acode >= m->abbrevs_vec.size())
-                        goto unknown;
-                const abbrev_entry &entry = m->abbrevs_vec[acode];
-                if (entry.code == 0)
-                        goto unknown;
-                return entry;
-        } else {
-                auto it = m->abbrevs_map.find(acode);
-                if (it == m->abbrevs_map.end())
-                        goto unknown;
-                return it->second;
-        }
+void
+unit::enable_die_index() const
+{
+        if (!m->dies)
+                m->dies = make_shared<die_index>(*this);
+}
 
-unknown:
-        throw format_error("unknown abbrev code 0x" + to_hex(acode));
+size_t
+unit::die_count() const
+{
+        enable_die_index();
+        return m->dies->offset.size();
 }
 
-void
-unit::impl::force_abbrevs()
+die
+unit::die_at(size_t index) const
 {
-        // XXX Compilation units can share abbrevs.  Parse each table
-        // at most once.
-        if (have_abbrevs)
-                return;
+        enable_die_index();
+        if (index >= m->dies->offset.size())
+                throw out_of_range("DIE index " + std::to_string(index) +
+                                   " out of range");
+        die d(this);
+        d.read(m->dies->offset[index]);
+        d.index = index;
+        return d;
+}
 
-        // Section 7.5.3
-        cursor c(file.get_section(section_type::abbrev),
-                 debug_abbrev_offset);
-        abbrev_entry entry;
-        abbrev_code highest = 0;
-        while (entry.read(&c)) {
-                abbrevs_map[entry.code] = entry;
-                if (entry.code > highest)
-                        highest = entry.code;
-        }
+const die_index *
+unit::get_die_index() const
+{
+        return m->dies.get();
+}
 
-        // Typically, abbrev codes are assigned linearly, so it's more
-        // space efficient and time efficient to store the table in a
-        // vector.  Convert to a vector if it's dense enough, by some
-        // rough estimate of "enough".
-        if (highest * 10 < abbrevs_map.size() * 15) {
-                // Move the map into the vector
-                abbrevs_vec.resize(highest + 1);
-                for (auto &entry : abbrevs_map)
-                        abbrevs_vec[entry.first] = move(entry.second);
-                abbrevs_map.clear();
+rangelist
+unit::cached_pc_range(const die &d) const
+{
+        {
+                lock_guard<mutex> guard(m->pc_ranges_lock);
+                auto it = m->pc_ranges.find(d.get_unit_offset());
+                if (it != m->pc_ranges.end())
+                        return it->second;
         }
 
-        have_abbrevs = true;
+        // Decode the ranges without holding the lock.  If another
+        // thread caches the same DIE's ranges first, use those.
+        rangelist res = die_pc_range(d).materialize();
+        lock_guard<mutex> guard(m->pc_ranges_lock);
+        return m->pc_ranges.emplace(d.get_unit_offset(), move(res)).first->second;
+}
+
+void
+unit::impl::force_abbrevs()
+{
+        if (!abbrevs)
+                abbrevs = file.get_abbrev_table(debug_abbrev_offset, subsec);
 }
 
 //////////////////////////////////////////////////////////////////
@@ -282,13 +511,13 @@ compilation_unit::compilation_unit(const dwarf &file, section_offset offset)
         {
             sub.skip_unit_type();
             ubyte address_size = sub.fixed<ubyte>();
-            subsec->addr_size = address_size;
+            subsec->set_addr_size(address_size);
             debug_abbrev_offset = sub.offset();
         }
         else {
             debug_abbrev_offset = sub.offset();
             ubyte address_size = sub.fixed<ubyte>();
-            subsec->addr_size = address_size;
+            subsec->set_addr_size(address_size);
         }
 
         m = make_shared<impl>(file, offset, subsec, debug_abbrev_offset,
@@ -337,7 +566,7 @@ type_unit::type_unit(const dwarf &file, section_offset offset)
         // .debug_abbrev-relative offset of this unit's abbrevs
         section_offset debug_abbrev_offset = sub.offset();
         ubyte address_size = sub.fixed<ubyte>();
-        subsec->addr_size = address_size;
+        subsec->set_addr_size(address_size);
         uint64_t type_signature = sub.fixed<uint64_t>();
         section_offset type_offset = sub.offset();
 
@@ -22,11 +22,13 @@ static const struct
         {".debug_line",     section_type::line},
         {".debug_loc",      section_type::loc},
         {".debug_macinfo",  section_type::macinfo},
+        {".debug_names",    section_type::names},
         {".debug_pubnames", section_type::pubnames},
         {".debug_pubtypes", section_type::pubtypes},
         {".debug_ranges",   section_type::ranges},
         {".debug_str",      section_type::str},
         {".debug_types",    section_type::types},
+        {".gdb_index",      section_type::gdb_index},
 };
 
 bool
@@ -0,0 +1,217 @@
+// Copyright (c) 2013 Austin T. Clements. All rights reserved.
+// Use of this source code is governed by an MIT license
+// that can be found in the LICENSE file.
+
+#include "internal.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+DWARFPP_BEGIN_NAMESPACE
+
+struct function_index::impl
+{
+        static const uint32_t none = ~(uint32_t)0;
+
+        // One node per function DIE.  For an inlined instance,
+        // parent is the node of the function DIE it was inlined
+        // into.  A subprogram starts a new chain, even if it is
+        // nested in another function (such as a GNU C nested
+        // function), so its parent is none.  depth is the number of
+        // function DIEs enclosing this one, which orders nested
+        // ranges.
+        struct node
+        {
+                frame fr;
+                uint32_t parent, depth;
+        };
+
+        vector<node> nodes;
+
+        // The disjoint intervals [low, high) of the index, sorted
+        // by address, and the innermost node covering each
+        vector<taddr> low, high;
+        vector<uint32_t> innermost;
+
+        void add_dies(const compilation_unit &cu, const die &parent,
+                      uint32_t parent_node, vector<taddr> *ranges,
+                      vector<uint32_t> *range_nodes);
+        void flatten(const vector<taddr> &ranges,
+                     const vector<uint32_t> &range_nodes);
+};
+
+const uint32_t function_index::impl::none;
+
+/**
+ * Add the function DIEs below parent to the index, appending their
+ * {low, high} pairs to *ranges and their nodes to *range_nodes.
+ */
+void
+function_index::impl::add_dies(const compilation_unit &cu, const die &parent,
+                               uint32_t parent_node, vector<taddr> *ranges,
+                               vector<uint32_t> *range_nodes)
+{
+        for (auto &d : parent) {
+                uint32_t self = parent_node;
+                if ((d.tag == DW_TAG::subprogram ||
+                     d.tag == DW_TAG::inlined_subroutine) &&
+                    (d.has(DW_AT::low_pc) || d.has(DW_AT::ranges))) {
+                        size_t nranges = ranges->size();
+                        try {
+                                for (auto &ent : die_pc_range(d)) {
+                                        if (ent.low >= ent.high)
+                                                continue;
+                                        ranges->push_back(ent.low);
+                                        ranges->push_back(ent.high);
+                                }
+                        } catch (out_of_range &e) {
+                                ranges->resize(nranges);
+                        } catch (value_type_mismatch &e) {
+                                ranges->resize(nranges);
+                        }
+
+                        if (ranges->size() != nranges) {
+                                node n;
+                                n.fr.function = die_ref(d);
+                                n.fr.call_file = nullptr;
+                                n.fr.call_line = n.fr.call_column = 0;
+                                if (d.tag == DW_TAG::inlined_subroutine) {
+                                        const line_table &lt = cu.get_line_table();
+                                        try {
+                                                if (d.has(DW_AT::call_file) && lt.valid())
+                                                        n.fr.call_file = lt.get_file(
+                                                                d[DW_AT::call_file].as_uconstant());
+                                        } catch (out_of_range &e) {
+                                        }
+                                        if (d.has(DW_AT::call_line))
+                                                n.fr.call_line =
+                                                        d[DW_AT::call_line].as_uconstant();
+                                        if (d.has(DW_AT::call_column))
+                                                n.fr.call_column =
+                                                        d[DW_AT::call_column].as_uconstant();
+                                }
+                                n.parent = d.tag == DW_TAG::inlined_subroutine ?
+                                        parent_node : none;
+                                n.depth = parent_node == none ? 0 :
+                                        nodes[parent_node].depth + 1;
+                                self = nodes.size();
+                                nodes.push_back(n);
+                                range_nodes->resize(ranges->size() / 2, self);
+                        }
+                }
+                // Inlined instances may be nested in lexical blocks
+                // and local functions in other scopes, so look
+                // everywhere
+                add_dies(cu, d, self, ranges, range_nodes);
+        }
+}
+
+/**
+ * Build the table of disjoint intervals from the ranges of every
+ * node.
+ */
+void
+function_index::impl::flatten(const vector<taddr> &ranges,
+                              const vector<uint32_t> &range_nodes)
+{
+        // Visit ranges by low address, outer functions first, so a
+        // function's ranges are visited before those of the
+        // functions inlined into it.
+        vector<uint32_t> order(range_nodes.size());
+        for (size_t i = 0; i < order.size(); i++)
+                order[i] = i;
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                        if (ranges[a * 2] != ranges[b * 2])
+                                return ranges[a * 2] < ranges[b * 2];
+                        return nodes[range_nodes[a]].depth <
+                                nodes[range_nodes[b]].depth;
+                });
+
+        // Sweep over the ranges with a stack of the ranges covering
+        // the current address.  Each stack entry is {high, node}.
+        vector<pair<taddr, uint32_t> > stack;
+        taddr pos = 0;
+        auto emit = [&](taddr to) {
+                if (stack.empty() || pos >= to)
+                        return;
+                uint32_t n = stack.back().second;
+                if (!high.empty() && high.back() == pos && innermost.back() == n) {
+                        high.back() = to;
+                } else {
+                        low.push_back(pos);
+                        high.push_back(to);
+                        innermost.push_back(n);
+                }
+                pos = to;
+        };
+        for (uint32_t r : order) {
+                taddr rlow = ranges[r * 2], rhigh = ranges[r * 2 + 1];
+                while (!stack.empty() && stack.back().first <= rlow) {
+                        emit(stack.back().first);
+                        stack.pop_back();
+                }
+                if (stack.empty()) {
+                        pos = rlow;
+                } else {
+                        emit(rlow);
+                        // Clip ranges that are not nested
+                        rhigh = min(rhigh, stack.back().first);
+                }
+                stack.push_back(make_pair(rhigh, range_nodes[r]));
+        }
+        while (!stack.empty()) {
+                emit(stack.back().first);
+                stack.pop_back();
+        }
+
+        low.shrink_to_fit();
+        high.shrink_to_fit();
+        innermost.shrink_to_fit();
+}
+
+function_index::function_index(const compilation_unit &cu)
+        : m(make_shared<impl>())
+{
+        // Complete the line table's file list before taking
+        // call_file pointers into it.  Decoding the line number
+        // program can add files, which would move the list.
+        const line_table &lt = cu.get_line_table();
+        if (lt.valid())
+                for (auto &ent : lt)
+                        (void)ent;
+
+        vector<taddr> ranges;
+        vector<uint32_t> range_nodes;
+        m->add_dies(cu, cu.root(), impl::none, &ranges, &range_nodes);
+        m->flatten(ranges, range_nodes);
+}
+
+bool
+function_index::find(taddr pc, vector<frame> *frames) const
+{
+        frames->clear();
+        if (!m)
+                return false;
+
+        // Find the last interval whose low address is <= pc
+        auto it = upper_bound(m->low.begin(), m->low.end(), pc);
+        if (it == m->low.begin())
+                return false;
+        size_t i = it - m->low.begin() - 1;
+        if (pc >= m->high[i])
+                return false;
+        for (uint32_t n = m->innermost[i]; n != impl::none; n = m->nodes[n].parent)
+                frames->push_back(m->nodes[n].fr);
+        return true;
+}
+
+size_t
+function_index::size() const
+{
+        if (!m)
+                return 0;
+        return m->low.size();
+}
+
+DWARFPP_END_NAMESPACE
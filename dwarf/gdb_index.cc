@@ -0,0 +1,214 @@
+// Copyright (c) 2013 Austin T. Clements. All rights reserved.
+// Use of this source code is governed by an MIT license
+// that can be found in the LICENSE file.
+
+#include "internal.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+DWARFPP_BEGIN_NAMESPACE
+
+// The .gdb_index format is documented in the "Index Section Format"
+// appendix of the GDB manual.  Unlike DWARF sections, it is always
+// little-endian.
+
+struct gdb_index::impl
+{
+        // The file is kept live because sec points into its
+        // .gdb_index section.
+        dwarf file;
+        shared_ptr<section> sec;
+        unsigned version;
+
+        section_offset cu_list, tu_list, address_area, symbol_table;
+        section_offset constant_pool;
+        uword cu_count, tu_count, address_count, symbol_slots;
+
+        // If the address area is not sorted by low address, the
+        // indexes of its entries in that order.  Otherwise empty.
+        vector<uword> address_order;
+
+        explicit impl(const dwarf &file);
+
+        uword word(section_offset off) const
+        {
+                return cursor(sec, off).fixed<uword>();
+        }
+
+        uint64_t dword(section_offset off) const
+        {
+                return cursor(sec, off).fixed<uint64_t>();
+        }
+
+        // Entry i of the address area is (low, high, CU index)
+        section_offset address_entry(uword i) const
+        {
+                if (!address_order.empty())
+                        i = address_order[i];
+                return address_area + (section_offset)i * 20;
+        }
+
+        /**
+         * Return the string at offset off in the constant pool, or
+         * nullptr if it is out of bounds or unterminated.
+         */
+        const char *pool_string(uword off, size_t *len_out) const
+        {
+                if (off >= (section_length)(sec->end - sec->begin) - constant_pool)
+                        return nullptr;
+                const char *p = sec->begin + constant_pool + off;
+                const char *end = (const char*)memchr(p, 0, sec->end - p);
+                if (!end)
+                        return nullptr;
+                *len_out = end - p;
+                return p;
+        }
+};
+
+gdb_index::impl::impl(const dwarf &file)
+        : file(file)
+{
+        shared_ptr<section> data = file.get_section(section_type::gdb_index);
+        sec = make_shared<section>(section_type::gdb_index, data->begin,
+                                   data->end - data->begin, byte_order::lsb);
+
+        cursor cur(sec);
+        version = cur.fixed<uword>();
+        // Versions before 7 lack symbol attributes and used a
+        // different hash
+        if (version < 7 || version > 9)
+                throw format_error("unsupported .gdb_index version " +
+                                   std::to_string(version));
+        cu_list = cur.fixed<uword>();
+        tu_list = cur.fixed<uword>();
+        address_area = cur.fixed<uword>();
+        symbol_table = cur.fixed<uword>();
+        section_offset symbol_table_end = cur.fixed<uword>();
+        // Version 9 adds a shortcut table after the symbol table
+        constant_pool = version >= 9 ? cur.fixed<uword>() : symbol_table_end;
+
+        section_length size = sec->end - sec->begin;
+        if (!(cu_list <= tu_list && tu_list <= address_area &&
+              address_area <= symbol_table &&
+              symbol_table <= symbol_table_end &&
+              symbol_table_end <= constant_pool && constant_pool <= size))
+                throw format_error(".gdb_index areas out of order");
+        cu_count = (tu_list - cu_list) / 16;
+        tu_count = (address_area - tu_list) / 24;
+        address_count = (symbol_table - address_area) / 20;
+        symbol_slots = (symbol_table_end - symbol_table) / 8;
+        if (symbol_slots & (symbol_slots - 1))
+                throw format_error(".gdb_index symbol table size is not a power of 2");
+
+        // GDB and linkers write the address area in order, but the
+        // format doesn't require it.
+        for (uword i = 1; i < address_count; i++) {
+                if (dword(address_entry(i)) < dword(address_entry(i - 1))) {
+                        vector<uword> order(address_count);
+                        for (uword j = 0; j < address_count; j++)
+                                order[j] = j;
+                        stable_sort(order.begin(), order.end(),
+                                    [this](uword a, uword b) {
+                                            return dword(address_area + (section_offset)a * 20) <
+                                                    dword(address_area + (section_offset)b * 20);
+                                    });
+                        address_order = move(order);
+                        break;
+                }
+        }
+}
+
+gdb_index::gdb_index(const dwarf &file)
+        : m(make_shared<impl>(file))
+{
+}
+
+unsigned
+gdb_index::version() const
+{
+        if (!m)
+                return 0;
+        return m->version;
+}
+
+bool
+gdb_index::find_address(taddr addr, section_offset *cu_offset_out) const
+{
+        if (!m)
+                return false;
+
+        // Find the last entry whose low address is <= addr
+        uword lo = 0, hi = m->address_count;
+        while (lo < hi) {
+                uword mid = lo + (hi - lo) / 2;
+                if (m->dword(m->address_entry(mid)) <= addr)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        if (lo == 0)
+                return false;
+        section_offset ent = m->address_entry(lo - 1);
+        if (addr >= m->dword(ent + 8))
+                return false;
+        uword cu = m->word(ent + 16);
+        if (cu >= m->cu_count)
+                throw format_error(".gdb_index address entry has bad CU index " +
+                                   std::to_string(cu));
+        *cu_offset_out = m->dword(m->cu_list + (section_offset)cu * 16);
+        return true;
+}
+
+vector<gdb_index::symbol>
+gdb_index::find(const string &name) const
+{
+        vector<symbol> res;
+        if (!m || m->symbol_slots == 0)
+                return res;
+
+        // The symbol table is an open-addressed hash table probed
+        // with a step derived from the hash
+        uint32_t hash = gdb_index_hash(name.data(), name.size());
+        uword mask = m->symbol_slots - 1;
+        uword slot = hash & mask, step = ((hash * 17) & mask) | 1;
+        for (uword n = 0; n < m->symbol_slots; n++, slot = (slot + step) & mask) {
+                section_offset ent = m->symbol_table + (section_offset)slot * 8;
+                uword name_off = m->word(ent), vec_off = m->word(ent + 4);
+                if (name_off == 0 && vec_off == 0)
+                        break;
+                size_t len;
+                const char *str = m->pool_string(name_off, &len);
+                if (!str)
+                        throw format_error(".gdb_index symbol name out of bounds");
+                if (len != name.size() || memcmp(str, name.data(), len) != 0)
+                        continue;
+
+                // Read the CU vector
+                cursor cur(m->sec, m->constant_pool + vec_off);
+                uword count = cur.fixed<uword>();
+                for (uword i = 0; i < count; i++) {
+                        uword val = cur.fixed<uword>();
+                        uword unit = val & 0xffffff;
+                        symbol sym;
+                        sym.kind = (symbol_kind)((val >> 28) & 7);
+                        sym.is_static = val >> 31;
+                        if (unit < m->cu_count) {
+                                sym.type_unit = false;
+                                sym.unit_offset = m->dword(m->cu_list + (section_offset)unit * 16);
+                        } else if (unit - m->cu_count < m->tu_count) {
+                                sym.type_unit = true;
+                                sym.unit_offset = m->dword(m->tu_list + (section_offset)(unit - m->cu_count) * 24);
+                        } else {
+                                throw format_error(".gdb_index symbol has bad unit index " +
+                                                   std::to_string(unit));
+                        }
+                        res.push_back(sym);
+                }
+                break;
+        }
+        return res;
+}
+
+DWARFPP_END_NAMESPACE
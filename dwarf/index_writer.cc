@@ -0,0 +1,390 @@
+// Copyright (c) 2013 Austin T. Clements. All rights reserved.
+// Use of this source code is governed by an MIT license
+// that can be found in the LICENSE file.
+
+#include "internal.hh"
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+using namespace std;
+
+DWARFPP_BEGIN_NAMESPACE
+
+namespace {
+        /**
+         * A growable section image in a fixed byte order.
+         */
+        struct section_writer
+        {
+                vector<char> data;
+                bool swap;
+
+                explicit section_writer(byte_order ord)
+                        : swap(ord != native_order()) { }
+
+                template<typename T>
+                void fixed(T val)
+                {
+                        typedef typename uint_of_size<sizeof(T)>::type U;
+                        U u = (U)val;
+                        if (swap)
+                                u = bswap(u);
+                        const char *p = (const char*)&u;
+                        data.insert(data.end(), p, p + sizeof(u));
+                }
+
+                template<typename T>
+                void fixed_at(size_t pos, T val)
+                {
+                        typedef typename uint_of_size<sizeof(T)>::type U;
+                        U u = (U)val;
+                        if (swap)
+                                u = bswap(u);
+                        memcpy(&data[pos], &u, sizeof(u));
+                }
+
+                void uleb128(uint64_t val)
+                {
+                        do {
+                                uint8_t b = val & 0x7f;
+                                val >>= 7;
+                                if (val)
+                                        b |= 0x80;
+                                data.push_back(b);
+                        } while (val);
+                }
+
+                void bytes(const char *p, size_t len)
+                {
+                        data.insert(data.end(), p, p + len);
+                }
+        };
+}
+
+/**
+ * Return v as a 32-bit section field, or throw format_error if it
+ * does not fit.
+ */
+static uword
+to_uword(uint64_t v, const char *what)
+{
+        if (v > 0xffffffff)
+                throw format_error(string(what) + " exceeds 32 bits");
+        return v;
+}
+
+//////////////////////////////////////////////////////////////////
+// .debug_names
+//
+
+/**
+ * Return the number of hash buckets for a .debug_names table of n
+ * distinct names.  This follows the LLVM heuristic so generated
+ * tables resemble compiler-generated ones.
+ */
+static uword
+debug_names_bucket_count(size_t n)
+{
+        if (n > 1024)
+                return n / 4;
+        if (n > 16)
+                return n / 2;
+        return max<size_t>(n, 1);
+}
+
+vector<char>
+write_debug_names(const dwarf &file, vector<char> *str_out, unsigned nthreads)
+{
+        vector<const compilation_unit*> units;
+        vector<vector<indexed_name> > unit_names;
+        collect_unit_names(file, nthreads, &units, &unit_names);
+
+        const char *str_begin = nullptr, *str_end = nullptr;
+        try {
+                shared_ptr<section> str = file.get_section(section_type::str);
+                str_begin = str->begin;
+                str_end = str->end;
+        } catch (format_error &e) {
+                // There's no .debug_str, so every name will be added
+        }
+
+        // Intern names.  Each name's entries are kept in unit order.
+        struct name_ent
+        {
+                uint32_t hash;
+                section_offset str_offset;
+                bool have_str_offset;
+                // (unit index, index in unit_names)
+                vector<pair<uint32_t, uint32_t> > dies;
+        };
+        unordered_map<string, uint32_t> name_ids;
+        vector<name_ent> names;
+        vector<const string*> name_strs;
+        auto add_name = [&](const char *name, uint32_t unit, uint32_t i) {
+                auto it = name_ids.emplace(name, names.size());
+                if (it.second) {
+                        size_t len = it.first->first.size();
+                        names.push_back({names_hash(name, len), 0, false, {}});
+                        name_strs.push_back(&it.first->first);
+                }
+                name_ent &ent = names[it.first->second];
+                if (!ent.have_str_offset && name >= str_begin && name < str_end) {
+                        ent.str_offset = name - str_begin;
+                        ent.have_str_offset = true;
+                }
+                if (ent.dies.empty() || ent.dies.back() != make_pair(unit, i))
+                        ent.dies.push_back(make_pair(unit, i));
+        };
+        for (uint32_t u = 0; u < units.size(); u++) {
+                auto &un = unit_names[u];
+                for (uint32_t i = 0; i < un.size(); i++) {
+                        if (un[i].declaration)
+                                continue;
+                        add_name(un[i].name, u, i);
+                        if (un[i].linkage_name &&
+                            strcmp(un[i].linkage_name, un[i].name) != 0)
+                                add_name(un[i].linkage_name, u, i);
+                }
+        }
+
+        // Add missing names to a copy of .debug_str
+        str_out->clear();
+        for (uint32_t n = 0; n < names.size(); n++) {
+                if (names[n].have_str_offset)
+                        continue;
+                if (str_out->empty())
+                        str_out->assign(str_begin, str_end);
+                names[n].str_offset = str_out->size();
+                const string &s = *name_strs[n];
+                str_out->insert(str_out->end(), s.begin(), s.end());
+                str_out->push_back(0);
+        }
+
+        // Order names by bucket (section 6.1.1.4.5)
+        uword bucket_count = debug_names_bucket_count(names.size());
+        vector<uint32_t> order(names.size());
+        for (uint32_t n = 0; n < names.size(); n++)
+                order[n] = n;
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                        uword ba = names[a].hash % bucket_count;
+                        uword bb = names[b].hash % bucket_count;
+                        if (ba != bb)
+                                return ba < bb;
+                        if (names[a].hash != names[b].hash)
+                                return names[a].hash < names[b].hash;
+                        return *name_strs[a] < *name_strs[b];
+                });
+
+        // Abbreviations (section 6.1.1.4.7).  There is one per tag.
+        // A table for a single unit can leave the unit implicit.
+        byte_order ord = file.get_section(section_type::info)->ord;
+        bool with_cu = units.size() > 1;
+        DW_FORM cu_form = units.size() <= 0x100 ? DW_FORM::data1 :
+                units.size() <= 0x10000 ? DW_FORM::data2 : DW_FORM::data4;
+        map<DW_TAG, uint64_t> abbrev_codes;
+        section_writer abbrevs(ord);
+
+        // Entry pool (section 6.1.1.4.8)
+        section_writer pool(ord);
+        vector<section_offset> entry_offsets(names.size());
+        for (uint32_t n : order) {
+                entry_offsets[n] = pool.data.size();
+                for (auto &d : names[n].dies) {
+                        const indexed_name &rec = unit_names[d.first][d.second];
+                        auto it = abbrev_codes.find(rec.tag);
+                        if (it == abbrev_codes.end()) {
+                                uint64_t code = abbrev_codes.size() + 1;
+                                it = abbrev_codes.emplace(rec.tag, code).first;
+                                abbrevs.uleb128(code);
+                                abbrevs.uleb128((uint64_t)rec.tag);
+                                if (with_cu) {
+                                        abbrevs.uleb128((uint64_t)DW_IDX::compile_unit);
+                                        abbrevs.uleb128((uint64_t)cu_form);
+                                }
+                                abbrevs.uleb128((uint64_t)DW_IDX::die_offset);
+                                abbrevs.uleb128((uint64_t)DW_FORM::ref4);
+                                abbrevs.uleb128(0);
+                                abbrevs.uleb128(0);
+                        }
+                        pool.uleb128(it->second);
+                        if (with_cu) {
+                                switch (cu_form) {
+                                case DW_FORM::data1:
+                                        pool.fixed<uint8_t>(d.first);
+                                        break;
+                                case DW_FORM::data2:
+                                        pool.fixed<uint16_t>(d.first);
+                                        break;
+                                default:
+                                        pool.fixed<uint32_t>(d.first);
+                                        break;
+                                }
+                        }
+                        pool.fixed<uword>(to_uword(rec.die_offset, "DIE offset"));
+                }
+                pool.uleb128(0);
+        }
+        abbrevs.uleb128(0);
+
+        // Header (section 6.1.1.4.1)
+        static const char augmentation[] = "LIBELFIN";
+        section_writer out(ord);
+        out.fixed<uword>(0);    // Filled in below
+        out.fixed<uhalf>(5);
+        out.fixed<uhalf>(0);
+        out.fixed<uword>(units.size());
+        out.fixed<uword>(0);
+        out.fixed<uword>(0);
+        out.fixed<uword>(bucket_count);
+        out.fixed<uword>(names.size());
+        out.fixed<uword>(abbrevs.data.size());
+        out.fixed<uword>(sizeof(augmentation) - 1);
+        out.bytes(augmentation, sizeof(augmentation) - 1);
+
+        for (auto cu : units)
+                out.fixed<uword>(to_uword(cu->get_section_offset(), "unit offset"));
+
+        // Buckets hold the 1-based index of their first name
+        vector<uword> buckets(bucket_count);
+        for (uint32_t i = order.size(); i-- > 0; )
+                buckets[names[order[i]].hash % bucket_count] = i + 1;
+        for (uword b : buckets)
+                out.fixed<uword>(b);
+        for (uint32_t n : order)
+                out.fixed<uword>(names[n].hash);
+        for (uint32_t n : order)
+                out.fixed<uword>(to_uword(names[n].str_offset, "string offset"));
+        for (uint32_t n : order)
+                out.fixed<uword>(to_uword(entry_offsets[n], "entry offset"));
+        out.bytes(abbrevs.data.data(), abbrevs.data.size());
+        out.bytes(pool.data.data(), pool.data.size());
+
+        out.fixed_at<uword>(0, to_uword(out.data.size() - 4, "name index size"));
+        return move(out.data);
+}
+
+//////////////////////////////////////////////////////////////////
+// .gdb_index
+//
+
+vector<char>
+write_gdb_index(const dwarf &file, unsigned nthreads)
+{
+        vector<const compilation_unit*> units;
+        vector<vector<indexed_name> > unit_names;
+        collect_unit_names(file, nthreads, &units, &unit_names);
+
+        unordered_map<section_offset, uword> unit_ids;
+        for (uword u = 0; u < units.size(); u++)
+                unit_ids[units[u]->get_section_offset()] = u;
+
+        // Intern qualified names and build their CU vectors
+        map<string, vector<uword> > symbols;
+        for (uword u = 0; u < units.size(); u++) {
+                auto &un = unit_names[u];
+                for (uint32_t i = 0; i < un.size(); i++) {
+                        const indexed_name &rec = un[i];
+                        gdb_index::symbol_kind kind;
+                        switch (rec.tag) {
+                        case DW_TAG::subprogram:
+                                kind = gdb_index::symbol_kind::function;
+                                break;
+                        case DW_TAG::variable:
+                                kind = gdb_index::symbol_kind::variable;
+                                break;
+                        case DW_TAG::namespace_:
+                                kind = gdb_index::symbol_kind::other;
+                                break;
+                        case DW_TAG::inlined_subroutine:
+                        case DW_TAG::label:
+                                // Inlined instances are indexed by
+                                // their out-of-line definitions, if
+                                // any
+                                continue;
+                        default:
+                                kind = gdb_index::symbol_kind::type;
+                                break;
+                        }
+                        // GDB only indexes names visible outside
+                        // functions
+                        if (rec.declaration || rec.local)
+                                continue;
+                        uword val = u | ((uword)kind << 28) |
+                                ((uword)rec.is_static << 31);
+                        vector<uword> &vec = symbols[qualified_name(un, i)];
+                        if (find(vec.begin(), vec.end(), val) == vec.end())
+                                vec.push_back(val);
+                }
+        }
+
+        // Constant pool: CU vectors followed by names
+        section_writer pool(byte_order::lsb);
+        vector<pair<uword, uword> > sym_offsets;
+        for (auto &sym : symbols) {
+                uword vec_off = pool.data.size();
+                pool.fixed<uword>(sym.second.size());
+                for (uword val : sym.second)
+                        pool.fixed<uword>(val);
+                sym_offsets.push_back(make_pair(0, vec_off));
+        }
+        size_t n = 0;
+        for (auto &sym : symbols) {
+                sym_offsets[n++].first = to_uword(pool.data.size(), ".gdb_index constant pool");
+                pool.bytes(sym.first.c_str(), sym.first.size() + 1);
+        }
+
+        // Symbol hash table.  Keep it at most 3/4 full.
+        uword slots = 8;
+        while (slots < symbols.size() * 4 / 3 + 1)
+                slots *= 2;
+        vector<pair<uword, uword> > table(slots, make_pair(0, 0));
+        n = 0;
+        for (auto &sym : symbols) {
+                uint32_t hash = gdb_index_hash(sym.first.data(), sym.first.size());
+                uword slot = hash & (slots - 1);
+                uword step = ((hash * 17) & (slots - 1)) | 1;
+                while (table[slot] != make_pair<uword, uword>(0, 0))
+                        slot = (slot + step) & (slots - 1);
+                table[slot] = sym_offsets[n++];
+        }
+
+        // Address area
+        vector<address_index::range> ranges;
+        for (auto &r : file.get_address_index().ranges())
+                if (unit_ids.count(r.cu_offset))
+                        ranges.push_back(r);
+
+        // Write the index
+        section_writer out(byte_order::lsb);
+        uint64_t cu_list = 6 * 4;
+        uint64_t tu_list = cu_list + units.size() * 16;
+        uint64_t address_area = tu_list;
+        uint64_t symbol_table = address_area + ranges.size() * 20;
+        uint64_t constant_pool = symbol_table + (uint64_t)slots * 8;
+        to_uword(constant_pool + pool.data.size(), ".gdb_index size");
+        out.fixed<uword>(8);
+        out.fixed<uword>(cu_list);
+        out.fixed<uword>(tu_list);
+        out.fixed<uword>(address_area);
+        out.fixed<uword>(symbol_table);
+        out.fixed<uword>(constant_pool);
+        for (auto cu : units) {
+                out.fixed<uint64_t>(cu->get_section_offset());
+                out.fixed<uint64_t>(cu->data()->end - cu->data()->begin);
+        }
+        for (auto &r : ranges) {
+                out.fixed<uint64_t>(r.low);
+                out.fixed<uint64_t>(r.high);
+                out.fixed<uword>(unit_ids[r.cu_offset]);
+        }
+        for (auto &slot : table) {
+                out.fixed<uword>(slot.first);
+                out.fixed<uword>(slot.second);
+        }
+        out.bytes(pool.data.data(), pool.data.size());
+        return move(out.data);
+}
+
+DWARFPP_END_NAMESPACE
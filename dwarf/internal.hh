@@ -8,7 +8,12 @@
 #include "dwarf++.hh"
 #include "../elf/to_hex.hh"
 
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
 #include <vector>
@@ -43,6 +48,60 @@ native_order()
         return test.c[0] == 1 ? byte_order::lsb : byte_order::msb;
 }
 
+template<unsigned Size> struct uint_of_size;
+template<> struct uint_of_size<1> { typedef std::uint8_t type; };
+template<> struct uint_of_size<2> { typedef std::uint16_t type; };
+template<> struct uint_of_size<4> { typedef std::uint32_t type; };
+template<> struct uint_of_size<8> { typedef std::uint64_t type; };
+
+static inline std::uint8_t
+bswap(std::uint8_t v)
+{
+        return v;
+}
+
+static inline std::uint16_t
+bswap(std::uint16_t v)
+{
+        return (v >> 8) | (v << 8);
+}
+
+static inline std::uint32_t
+bswap(std::uint32_t v)
+{
+        return __builtin_bswap32(v);
+}
+
+static inline std::uint64_t
+bswap(std::uint64_t v)
+{
+        return __builtin_bswap64(v);
+}
+
+/**
+ * Load a T from possibly unaligned memory at p with a native load,
+ * byte-swapping it if Swap is true.  T must be an integer or enum
+ * type of 1, 2, 4, or 8 bytes.
+ */
+template<typename T, bool Swap>
+static inline T
+load_fixed(const char *p)
+{
+        typedef typename uint_of_size<sizeof(T)>::type U;
+        U val;
+        memcpy(&val, p, sizeof(val));
+        if (Swap)
+                val = bswap(val);
+        return (T)val;
+}
+
+template<typename T, bool Swap>
+static taddr
+load_address(const char *p)
+{
+        return load_fixed<T, Swap>(p);
+}
+
 /**
  * A single DWARF section or a slice of a section.  This also tracks
  * dynamic information necessary to decode values in this section.
@@ -53,14 +112,52 @@ struct section
         const char *begin, *end;
         const format fmt;
         const byte_order ord;
+        // The address size of this section.  Use set_addr_size to
+        // change this.
         unsigned addr_size;
 
+        // Readers specialized for this section, selected when the
+        // section's byte order and address size are set.  swap is
+        // true if ord is not the native byte order.  read_address is
+        // null if addr_size is not a supported address size.
+        bool swap;
+        taddr (*read_address)(const char *p);
+
         section(section_type type, const void *begin,
                 section_length length,
                 byte_order ord, format fmt = format::unknown,
                 unsigned addr_size = 0)
                 : type(type), begin((char*)begin), end((char*)begin + length),
-                  fmt(fmt), ord(ord), addr_size(addr_size) { }
+                  fmt(fmt), ord(ord), swap(ord != native_order())
+        {
+                set_addr_size(addr_size);
+        }
+
+        void set_addr_size(unsigned size)
+        {
+                addr_size = size;
+                switch (size) {
+                case 1:
+                        read_address = swap ? load_address<std::uint8_t, true> :
+                                load_address<std::uint8_t, false>;
+                        break;
+                case 2:
+                        read_address = swap ? load_address<std::uint16_t, true> :
+                                load_address<std::uint16_t, false>;
+                        break;
+                case 4:
+                        read_address = swap ? load_address<std::uint32_t, true> :
+                                load_address<std::uint32_t, false>;
+                        break;
+                case 8:
+                        read_address = swap ? load_address<std::uint64_t, true> :
+                                load_address<std::uint64_t, false>;
+                        break;
+                default:
+                        read_address = nullptr;
+                        break;
+                }
+        }
 
         section(const section &o) = default;
 
@@ -91,18 +188,23 @@ struct section
  */
 struct cursor
 {
-        // XXX There's probably a lot of overhead to maintaining the
-        // shared pointer to the section from this.  Perhaps the rule
-        // should be that all objects keep the dwarf::impl alive
-        // (directly or indirectly) and that keeps the loader alive,
-        // so a cursor just needs a regular section*.
-
-        std::shared_ptr<section> sec;
+        // A cursor borrows its section rather than sharing ownership
+        // of it, since cursors are constructed in the hottest loops
+        // and maintaining a reference count would cost two atomic
+        // operations per cursor.  The section must outlive the
+        // cursor.  Sections belonging to a dwarf file are kept live
+        // by the file (via the units and line tables that hold
+        // them), so this is only a concern for cursors over
+        // temporary sections.
+
+        const section *sec;
         const char *pos;
 
         cursor()
-                : pos(nullptr) { }
-        cursor(const std::shared_ptr<section> sec, section_offset offset = 0)
+                : sec(nullptr), pos(nullptr) { }
+        cursor(const std::shared_ptr<section> &sec, section_offset offset = 0)
+                : sec(sec.get()), pos(sec->begin + offset) { }
+        cursor(const section *sec, section_offset offset = 0)
                 : sec(sec), pos(sec->begin + offset) { }
 
         /**
@@ -114,6 +216,13 @@ struct cursor
          * skip_initial_length).
          */
         std::shared_ptr<section> subsection();
+        /**
+         * Skip a subsection without constructing a section for it.
+         * Returns the length of the subsection, including its
+         * initial length, and sets *fmt_out to its DWARF format if
+         * fmt_out is non-null.
+         */
+        section_length skip_subsection(format *fmt_out = nullptr);
         std::int64_t sleb128();
         section_offset offset();
         void string(std::string &out);
@@ -131,50 +240,44 @@ struct cursor
         {
                 ensure(sizeof(T));
                 static_assert(sizeof(T) <= 8, "T too big");
-                uint64_t val = 0;
-                const unsigned char *p = (const unsigned char*)pos;
-                if (sec->ord == byte_order::lsb) {
-                        for (unsigned i = 0; i < sizeof(T); i++)
-                                val |= ((uint64_t)p[i]) << (i * 8);
-                } else {
-                        for (unsigned i = 0; i < sizeof(T); i++)
-                                val = (val << 8) | (uint64_t)p[i];
-                }
+                T val = sec->swap ? load_fixed<T, true>(pos) :
+                        load_fixed<T, false>(pos);
                 pos += sizeof(T);
-                return (T)val;
+                return val;
         }
 
         std::uint64_t uleb128()
         {
-                // Appendix C
-                // XXX Pre-compute all two byte ULEB's
-                std::uint64_t result = 0;
-                int shift = 0;
-                while (pos < sec->end) {
-                        uint8_t byte = *(uint8_t*)(pos++);
-                        result |= (uint64_t)(byte & 0x7f) << shift;
-                        if ((byte & 0x80) == 0)
-                                return result;
-                        shift += 7;
+                // Appendix C.  Most LEB128 values are one or two
+                // bytes, so decode those inline.
+                if (sec->end - pos >= 2) {
+                        uint8_t b0 = pos[0];
+                        if (!(b0 & 0x80)) {
+                                pos += 1;
+                                return b0;
+                        }
+                        uint8_t b1 = pos[1];
+                        if (!(b1 & 0x80)) {
+                                pos += 2;
+                                return (b0 & 0x7f) | ((std::uint64_t)b1 << 7);
+                        }
                 }
-                underflow();
-                return 0;
+                return uleb128_slow();
         }
 
+        /**
+         * Skip n consecutive LEB128 values (signed or unsigned).
+         */
+        void skip_leb128s(unsigned n);
+
         taddr address()
         {
-                switch (sec->addr_size) {
-                case 1:
-                        return fixed<uint8_t>();
-                case 2:
-                        return fixed<uint16_t>();
-                case 4:
-                        return fixed<uint32_t>();
-                case 8:
-                        return fixed<uint64_t>();
-                default:
+                if (!sec->read_address)
                         throw std::runtime_error("address size " + std::to_string(sec->addr_size) + " not supported");
-                }
+                ensure(sec->addr_size);
+                taddr val = sec->read_address(pos);
+                pos += sec->addr_size;
+                return val;
         }
 
         void skip_initial_length();
@@ -213,12 +316,27 @@ struct cursor
         }
 
 private:
-        cursor(const std::shared_ptr<section> sec, const char *pos)
+        cursor(const section *sec, const char *pos)
                 : sec(sec), pos(pos) { }
 
         void underflow();
+        std::uint64_t uleb128_slow();
 };
 
+/**
+ * Return the number of set bits in x.  Unlike __builtin_popcountll,
+ * this doesn't become a library call when the target lacks a
+ * population count instruction.
+ */
+static inline unsigned
+popcount64(std::uint64_t x)
+{
+        x = x - ((x >> 1) & 0x5555555555555555ull);
+        x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+        x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+        return (x * 0x0101010101010101ull) >> 56;
+}
+
 /**
  * An attribute specification in an abbrev.
  */
@@ -230,11 +348,49 @@ struct attribute_spec
         // Computed information
         value::type type;
 
+        // Decode plan, filled in by abbrev_table.  If variable is
+        // false, the attribute has a fixed size in its unit.  The
+        // attribute begins offset bytes after the end of the
+        // previous variable-size attribute of the DIE or, if there
+        // is none, after the abbrev code.
+        bool variable;
+        std::uint32_t offset;
+
         attribute_spec(DW_AT name, DW_FORM form);
 };
 
 typedef std::uint64_t abbrev_code;
 
+/**
+ * A contiguous sequence of attribute specifications.
+ */
+struct attribute_spec_span
+{
+        const attribute_spec *first, *last;
+
+        attribute_spec_span() : first(nullptr), last(nullptr) { }
+
+        const attribute_spec *begin() const
+        {
+                return first;
+        }
+
+        const attribute_spec *end() const
+        {
+                return last;
+        }
+
+        size_t size() const
+        {
+                return last - first;
+        }
+
+        const attribute_spec &operator[](size_t index) const
+        {
+                return first[index];
+        }
+};
+
 /**
  * An entry in .debug_abbrev.
  */
@@ -243,11 +399,139 @@ struct abbrev_entry
         abbrev_code code;
         DW_TAG tag;
         bool children;
-        std::vector<attribute_spec> attributes;
+        // Points into the specs of the abbrev_table containing this
+        // entry
+        attribute_spec_span attributes;
+        // The total size of the attributes following the last
+        // variable-size attribute (or of all of the attributes, if
+        // none are variable-size)
+        std::uint32_t fixed_tail;
+
+        // Attribute lookup, filled in by abbrev_table.  Bit n of
+        // common is set if attribute n is present, for n less than
+        // num_common.  The slot of a common attribute is stored in
+        // common_slots at the attribute's rank in the bitmap.
+        // Other attributes (typically vendor extensions) are found
+        // with a perfect hash of size 1 << vendor_bits; unused
+        // buckets have name 0.
+        static const unsigned num_common = 192;
+        std::uint64_t common[num_common / 64];
+        const std::uint16_t *common_slots;
+        struct vendor_slot
+        {
+                DW_AT name;
+                std::uint16_t slot;
+        };
+        const vendor_slot *vendor;
+        unsigned vendor_bits;
+        std::uint32_t vendor_mult;
+
+        abbrev_entry() : code(0), common(), common_slots(nullptr),
+                         vendor(nullptr), vendor_bits(0), vendor_mult(0) { }
+
+        static unsigned vendor_hash(DW_AT name, std::uint32_t mult,
+                                    unsigned bits)
+        {
+                return ((std::uint32_t)name * mult) >> (32 - bits);
+        }
+
+        /**
+         * Return the index in attributes of the attribute name, or
+         * -1 if this entry doesn't have that attribute.  This takes
+         * constant time.
+         */
+        int find(DW_AT name) const
+        {
+                unsigned n = (unsigned)name;
+                if (n < num_common) {
+                        std::uint64_t bit = (std::uint64_t)1 << (n % 64);
+                        if (!(common[n / 64] & bit))
+                                return -1;
+                        unsigned rank = popcount64(common[n / 64] & (bit - 1));
+                        for (unsigned w = 0; w < n / 64; w++)
+                                rank += popcount64(common[w]);
+                        return common_slots[rank];
+                }
+                if (!vendor)
+                        return -1;
+                const vendor_slot &v = vendor[vendor_hash(name, vendor_mult,
+                                                          vendor_bits)];
+                if (v.name != name)
+                        return -1;
+                return v.slot;
+        }
+};
+
+/**
+ * A parsed abbrev table from .debug_abbrev, compiled into decode
+ * plans for units with a particular address size and DWARF format.
+ * Units that use the same abbrev table and unit format share a
+ * single abbrev_table (see dwarf::get_abbrev_table).  Since its
+ * entries point into its own specs array, this cannot be copied.
+ */
+struct abbrev_table
+{
+        // The attribute specifications of all entries, stored
+        // contiguously.
+        std::vector<attribute_spec> specs;
+        // Attribute lookup tables of all entries
+        std::vector<std::uint16_t> common_slots;
+        std::vector<abbrev_entry::vendor_slot> vendor_slots;
+
+        // If dense, entries is indexed by abbrev code, with unused
+        // codes having code 0.  Otherwise, entries is sorted by
+        // code.
+        bool dense;
+        std::vector<abbrev_entry> entries;
+
+        /**
+         * Parse the abbrev table starting at cur and compile decode
+         * plans for units with the given address size and format.
+         */
+        abbrev_table(cursor cur, unsigned addr_size, format fmt);
+        abbrev_table(const abbrev_table &o) = delete;
+        abbrev_table &operator=(const abbrev_table &o) = delete;
+
+        /**
+         * Return the entry for code, or nullptr if there is none.
+         */
+        const abbrev_entry *find(abbrev_code code) const;
+};
 
-        abbrev_entry() : code(0) { }
+/**
+ * A flattened index of the DIE tree of a unit.  DIEs are numbered in
+ * depth-first order, which is also the order they appear in the
+ * unit, and each field is stored in a separate array indexed by DIE
+ * number.  Sibling list terminators are not included.  Offsets are
+ * relative to the unit's data, like die::offset.
+ */
+struct die_index
+{
+        static const std::uint32_t none = ~(std::uint32_t)0;
+
+        std::vector<std::uint32_t> offset;
+        std::vector<const abbrev_entry*> abbrev;
+        // The parent of each DIE, or none for the root DIE
+        std::vector<std::uint32_t> parent;
+        // The next sibling of each DIE, or none for the last child
+        std::vector<std::uint32_t> next_sibling;
+        std::vector<std::uint32_t> depth;
+        // The offset just past each DIE's subtree.  This is the
+        // offset of its next sibling or of the terminator of its
+        // sibling list.
+        std::vector<std::uint32_t> subtree_end;
 
-        bool read(cursor *cur);
+        /**
+         * Index the DIE tree of u in one pass over its data.  Throws
+         * format_error if the unit is too large to index.
+         */
+        explicit die_index(const unit &u);
+
+        /**
+         * Return the number of the DIE at the given unit-relative
+         * offset, or none if no DIE begins there.
+         */
+        std::uint32_t find(section_offset off) const;
 };
 
 /**
@@ -258,6 +542,8 @@ struct name_unit
         uhalf version;
         section_offset debug_info_offset;
         section_length debug_info_length;
+        // This unit's subsection, which entries points into
+        std::shared_ptr<section> subsec;
         // Cursor to the first name_entry in this unit.  This cursor's
         // section is limited to this unit.
         cursor entries;
@@ -265,7 +551,7 @@ struct name_unit
         void read(cursor *cur)
         {
                 // Section 7.19
-                std::shared_ptr<section> subsec = cur->subsection();
+                subsec = cur->subsection();
                 cursor sub(subsec);
                 sub.skip_initial_length();
                 version = sub.fixed<uhalf>();
@@ -285,13 +571,183 @@ struct name_entry
         section_offset offset;
         std::string name;
 
+        /**
+         * Read an entry.  An entry with offset 0 terminates its unit
+         * and has no name.
+         */
         void read(cursor *cur)
         {
                 offset = cur->offset();
-                cur->string(name);
+                if (offset == 0)
+                        name.clear();
+                else
+                        cur->string(name);
         }
 };
 
+/**
+ * Return the .debug_names hash of the len-byte name s (DWARF5 section
+ * 7.33), which is the DJB hash of the case-folded name.  Only ASCII
+ * letters are folded.  Other bytes are hashed unchanged, which agrees
+ * with full Unicode case folding for names with no non-ASCII capital
+ * letters.
+ */
+static inline std::uint32_t
+names_hash(const char *s, size_t len)
+{
+        std::uint32_t h = 5381;
+        for (size_t i = 0; i < len; i++) {
+                unsigned char c = s[i];
+                if (c >= 'A' && c <= 'Z')
+                        c += 'a' - 'A';
+                h = h * 33 + c;
+        }
+        return h;
+}
+
+/**
+ * Return the .gdb_index symbol table hash of the len-byte name s.
+ * This is GDB's mapped_index_string_hash, which folds ASCII case in
+ * index versions 5 and later.
+ */
+static inline std::uint32_t
+gdb_index_hash(const char *s, size_t len)
+{
+        std::uint32_t r = 0;
+        for (size_t i = 0; i < len; i++) {
+                unsigned char c = s[i];
+                if (c >= 'A' && c <= 'Z')
+                        c += 'a' - 'A';
+                r = r * 67 + c - 113;
+        }
+        return r;
+}
+
+/**
+ * Return a 64-bit hash of the len-byte string s.  This is 64-bit
+ * FNV-1a followed by the MurmurHash3 finalizer, so every input bit
+ * affects every output bit and the high and low bits can be used as
+ * independent hashes.
+ */
+static inline std::uint64_t
+strong_string_hash(const char *s, size_t len)
+{
+        std::uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < len; i++) {
+                h ^= (unsigned char)s[i];
+                h *= 0x100000001b3ull;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+}
+
+/**
+ * A DIE that belongs in a name index, as found by collect_names.
+ */
+struct indexed_name
+{
+        // The DIE's name and linkage name.  linkage_name is nullptr
+        // if the DIE has none.  These point into the file's section
+        // data (or are static strings).
+        const char *name, *linkage_name;
+        // The offset of the DIE from the beginning of its unit
+        section_offset die_offset;
+        DW_TAG tag;
+        // True if the DIE is not visible outside its unit
+        bool is_static;
+        // True if the DIE is nested in a function
+        bool local;
+        // True if this is a declaration of a namespace or type.
+        // These are collected only to serve as parents.
+        bool declaration;
+        // The index of the enclosing namespace or type in the unit's
+        // list of names, or none
+        std::uint32_t parent;
+
+        static const std::uint32_t none = ~0;
+};
+
+/**
+ * Append the DIEs of cu that belong in a name index to *out.  These
+ * are the defining DIEs of functions (including inlined instances),
+ * variables with static storage, named types, labels, and namespaces,
+ * wherever they appear, as described in DWARF5 section 6.1.1.1.
+ * Names of DIEs that complete a declaration (via
+ * DW_AT::specification or DW_AT::abstract_origin) come from that
+ * declaration.  This reads only cu, so it is safe to call
+ * concurrently for different units.
+ */
+void
+collect_names(const compilation_unit &cu, std::vector<indexed_name> *out);
+
+/**
+ * Collect the names of every compilation unit in file using up to
+ * nthreads threads (0 means one per hardware thread).  (*names)[i]
+ * holds the names of (*units)[i].
+ */
+void
+collect_unit_names(const dwarf &file, unsigned nthreads,
+                   std::vector<const compilation_unit*> *units,
+                   std::vector<std::vector<indexed_name> > *names);
+
+/**
+ * Return the fully qualified name of names[i], such as "ns::type::f".
+ */
+std::string
+qualified_name(const std::vector<indexed_name> &names, std::uint32_t i);
+
+/**
+ * Call fn(i) for each i in [0, n), spreading the calls across a pool
+ * of up to nthreads threads (including the calling thread).  If
+ * nthreads is 0, this uses one thread per hardware thread.  Calls
+ * for different i may run concurrently, so fn must only touch state
+ * that is private to i or otherwise synchronized.  If any call
+ * throws, the remaining work is abandoned and the first exception is
+ * rethrown in the calling thread.
+ */
+template<typename Fn>
+void
+parallel_for(size_t n, unsigned nthreads, Fn fn)
+{
+        if (nthreads == 0)
+                nthreads = std::thread::hardware_concurrency();
+        if (nthreads > n)
+                nthreads = n;
+        if (nthreads <= 1) {
+                for (size_t i = 0; i < n; i++)
+                        fn(i);
+                return;
+        }
+
+        std::atomic<size_t> next(0);
+        std::exception_ptr err;
+        std::mutex err_lock;
+        auto worker = [&]() {
+                try {
+                        for (size_t i; (i = next++) < n; )
+                                fn(i);
+                } catch (...) {
+                        std::lock_guard<std::mutex> guard(err_lock);
+                        if (!err)
+                                err = std::current_exception();
+                        next = n;
+                }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned t = 1; t < nthreads; t++)
+                threads.emplace_back(worker);
+        worker();
+        for (auto &t : threads)
+                t.join();
+        if (err)
+                std::rethrow_exception(err);
+}
+
 DWARFPP_END_NAMESPACE
 
 #endif
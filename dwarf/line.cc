@@ -4,6 +4,7 @@
 
 #include "internal.hh"
 
+#include <algorithm>
 #include <cassert>
 
 using namespace std;
@@ -49,11 +50,101 @@ struct line_table::impl
         // know we've gathered all file names.
         bool file_names_complete;
 
-        impl() : last_file_name_end(0), file_names_complete(false) {};
+        // Address index (see enable_address_index).  rows holds
+        // every row of the line number program in program order and
+        // row_pos holds the offset in sec just past the opcode that
+        // emitted each row.  sequences describes each sequence in
+        // rows that covers at least one address, sorted by low
+        // address.  max_high[i] is the highest address covered by
+        // sequences[0..i].
+        struct sequence
+        {
+                taddr low, high;
+                // Index of the first row and of the end_sequence row
+                size_t first, last;
+        };
+        bool want_index, have_index;
+        compact_line_table rows;
+        vector<uint32_t> row_pos;
+        vector<sequence> sequences;
+        vector<taddr> max_high;
+
+        impl() : last_file_name_end(0), file_names_complete(false),
+                 want_index(false), have_index(false) {};
 
         bool read_file_entry(cursor *cur, bool in_header);
+        template<typename Fn>
+        void decode(const line_table *table, Fn fn);
+        void build_index(const line_table *table);
 };
 
+struct compact_line_table::impl
+{
+        // Rows are stored in blocks of block_size rows.  The flag
+        // bitsets store one word per block.
+        static const size_t block_size = 64;
+        // Marks an address or packed field stored out of line
+        static const uint32_t escape32 = ~(uint32_t)0;
+        static const unsigned escape16 = 0xffff;
+
+        enum flag
+        {
+                is_stmt,
+                basic_block,
+                end_sequence,
+                prologue_end,
+                epilogue_begin,
+                // The row has an entry in extras
+                has_extra,
+                num_flags
+        };
+
+        // Fields that are usually 0 or small enough to pack
+        struct extra
+        {
+                size_t row;
+                unsigned column, file_index, op_index, isa, discriminator;
+        };
+
+        // The line table this was decoded from and its file names.
+        // table may be invalid when this is owned by the line table
+        // itself, in which case the owner keeps files alive.
+        line_table table;
+        const vector<line_table::file> *files;
+
+        size_t count;
+        // The lowest address in each block
+        vector<taddr> block_base;
+        // The offset of each row's address from its block's base,
+        // or escape32 if the address is in wide_addrs
+        vector<uint32_t> addr_delta;
+        vector<pair<size_t, taddr> > wide_addrs;
+        // The line of each row in the low 32 bits, then the column
+        // and file index in 16 bits each, or escape16 if the row has
+        // an extra
+        vector<uint64_t> line_col_file;
+        vector<uint64_t> flags[num_flags];
+        vector<extra> extras;
+
+        // Rows of the current incomplete block
+        vector<line_table::entry> pending;
+
+        impl() : files(nullptr), count(0) { }
+
+        void append(const line_table::entry &e);
+        void flush();
+        void finish();
+
+        bool get_flag(size_t row, flag f) const
+        {
+                return (flags[f][row / block_size] >> (row % block_size)) & 1;
+        }
+};
+
+const size_t compact_line_table::impl::block_size;
+const uint32_t compact_line_table::impl::escape32;
+const unsigned compact_line_table::impl::escape16;
+
 line_table::line_table(const shared_ptr<section> &sec, section_offset offset,
                        unsigned cu_addr_size, const string &cu_comp_dir,
                        const string &cu_name)
@@ -73,7 +164,7 @@ line_table::line_table(const shared_ptr<section> &sec, section_offset offset,
         m->sec = cur.subsection();
         cur = cursor(m->sec);
         cur.skip_initial_length();
-        m->sec->addr_size = cu_addr_size;
+        m->sec->set_addr_size(cu_addr_size);
 
         // Basic header information
         uhalf version = cur.fixed<uhalf>();
@@ -161,9 +252,138 @@ line_table::end() const
         return iterator(this, m->sec->size());
 }
 
+void
+line_table::enable_address_index() const
+{
+        if (valid())
+                m->want_index = true;
+}
+
+/**
+ * Run the whole line number program, calling fn(row, pos) for every
+ * row emitted, including the final end_sequence row, where pos is the
+ * offset in sec just past the opcode that emitted row.  This runs the
+ * program directly rather than using an iterator, since an iterator
+ * can't distinguish the final end_sequence row from the end of the
+ * table.  The file field of each row is not filled in.
+ */
+template<typename Fn>
+void
+line_table::impl::decode(const line_table *table, Fn fn)
+{
+        iterator it(nullptr, 0);
+        it.table = table;
+        it.regs.reset(default_is_stmt);
+        cursor cur(sec, program_offset);
+        while (!cur.end()) {
+                if (!it.step(&cur))
+                        continue;
+                if (it.entry.file_index >= file_names.size())
+                        throw format_error("bad file index " +
+                                           std::to_string(it.entry.file_index) +
+                                           " in line table");
+                fn(it.entry, cur.get_section_offset());
+        }
+        file_names_complete = true;
+}
+
+void
+line_table::impl::build_index(const line_table *table)
+{
+        // Positions are stored in 32 bits.  A line number program
+        // this large can't be indexed, so find_address will fall
+        // back to a linear scan.
+        if (sec->size() > UINT32_MAX) {
+                want_index = false;
+                return;
+        }
+
+        // rows doesn't keep the table alive, since that would be a
+        // reference cycle.
+        rows.m = make_shared<compact_line_table::impl>();
+        rows.m->files = &file_names;
+        size_t seq_start = 0;
+        taddr seq_low = 0;
+        try {
+                decode(table, [&](const line_table::entry &row, section_offset pos) {
+                                size_t index = rows.m->count;
+                                rows.m->append(row);
+                                row_pos.push_back(pos);
+                                if (index == seq_start)
+                                        seq_low = row.address;
+                                if (!row.end_sequence)
+                                        return;
+                                if (seq_low < row.address)
+                                        sequences.push_back({seq_low, row.address,
+                                                             seq_start, index});
+                                seq_start = index + 1;
+                        });
+        } catch (...) {
+                // Discard the partial index, so the next
+                // find_address tries again and reports the error
+                rows = compact_line_table();
+                row_pos.clear();
+                sequences.clear();
+                throw;
+        }
+        rows.m->finish();
+
+        // Sort by starting address, breaking ties by program order so
+        // overlapping sequences resolve the same way a linear scan
+        // would.
+        sort(sequences.begin(), sequences.end(),
+             [](const sequence &a, const sequence &b) {
+                     if (a.low != b.low)
+                             return a.low < b.low;
+                     return a.first < b.first;
+             });
+        for (auto &seq : sequences)
+                max_high.push_back(max_high.empty() ? seq.high :
+                                   max(max_high.back(), seq.high));
+
+        row_pos.shrink_to_fit();
+        have_index = true;
+}
+
 line_table::iterator
 line_table::find_address(taddr addr) const
 {
+        if (valid() && m->want_index && !m->have_index)
+                m->build_index(this);
+
+        if (valid() && m->want_index) {
+                // Find the last sequence starting at or below addr,
+                // then check it and any earlier sequences that might
+                // still cover addr.  Normally sequences are disjoint
+                // and this examines just one.
+                auto &seqs = m->sequences;
+                size_t i = upper_bound(seqs.begin(), seqs.end(), addr,
+                                       [](taddr a, const impl::sequence &s) {
+                                               return a < s.low;
+                                       }) - seqs.begin();
+                const impl::sequence *best = nullptr;
+                while (i > 0 && m->max_high[i - 1] > addr) {
+                        const impl::sequence &seq = seqs[--i];
+                        if (addr < seq.high && (!best || seq.first < best->first))
+                                best = &seq;
+                }
+                if (!best)
+                        return end();
+
+                // Find the last row at or below addr.  The
+                // end_sequence row is above addr, so this is always
+                // a real row.
+                size_t lo = best->first, hi = best->last;
+                while (hi - lo > 1) {
+                        size_t mid = lo + (hi - lo) / 2;
+                        if (m->rows.address(mid) <= addr)
+                                lo = mid;
+                        else
+                                hi = mid;
+                }
+                return iterator(this, m->row_pos[lo], m->rows[lo]);
+        }
+
         iterator prev = begin(), e = end();
         if (prev == e)
                 return prev;
@@ -174,6 +394,12 @@ line_table::find_address(taddr addr) const
                     !prev->end_sequence)
                         return prev;
         }
+        // The final end_sequence row is at the same position as
+        // end(), so the loop above never examines it, but it's still
+        // the current entry of the iterator that reached the end.
+        if (it->end_sequence && prev->address <= addr &&
+            it->address > addr && !prev->end_sequence)
+                return prev;
         prev = e;
         return prev;
 }
@@ -202,7 +428,7 @@ line_table::get_file(unsigned index) const
 bool
 line_table::impl::read_file_entry(cursor *cur, bool in_header)
 {
-        assert(cur->sec == sec);
+        assert(cur->sec == sec.get());
 
         string file_name;
         cur->string(file_name);
@@ -230,6 +456,176 @@ line_table::impl::read_file_entry(cursor *cur, bool in_header)
         return true;
 }
 
+compact_line_table::compact_line_table(const line_table &table)
+{
+        if (!table.valid())
+                return;
+        m = make_shared<impl>();
+        m->table = table;
+        m->files = &table.m->file_names;
+        table.m->decode(&table, [this](const line_table::entry &row,
+                                       section_offset pos) {
+                                m->append(row);
+                        });
+        m->finish();
+}
+
+void
+compact_line_table::impl::append(const line_table::entry &e)
+{
+        pending.push_back(e);
+        count++;
+        if (pending.size() == block_size)
+                flush();
+}
+
+/**
+ * Encode the rows in pending as a new block.
+ */
+void
+compact_line_table::impl::flush()
+{
+        if (pending.empty())
+                return;
+
+        size_t first = count - pending.size();
+        taddr base = pending[0].address;
+        for (auto &e : pending)
+                base = min(base, e.address);
+        block_base.push_back(base);
+
+        uint64_t words[num_flags] = {};
+        for (size_t i = 0; i < pending.size(); i++) {
+                const line_table::entry &e = pending[i];
+                size_t row = first + i;
+
+                if (e.address - base < escape32) {
+                        addr_delta.push_back(e.address - base);
+                } else {
+                        addr_delta.push_back(escape32);
+                        wide_addrs.push_back(make_pair(row, e.address));
+                }
+
+                uint64_t column = e.column, file_index = e.file_index;
+                bool has_extra = column >= escape16 || file_index >= escape16 ||
+                        e.op_index || e.isa || e.discriminator;
+                if (has_extra) {
+                        extras.push_back({row, e.column, e.file_index,
+                                          e.op_index, e.isa, e.discriminator});
+                        column = file_index = escape16;
+                }
+                line_col_file.push_back((uint64_t)e.line | (column << 32) |
+                                        (file_index << 48));
+
+                bool bits[num_flags] = {e.is_stmt, e.basic_block,
+                                        e.end_sequence, e.prologue_end,
+                                        e.epilogue_begin, has_extra};
+                for (int f = 0; f < num_flags; f++)
+                        words[f] |= (uint64_t)bits[f] << i;
+        }
+        for (int f = 0; f < num_flags; f++)
+                flags[f].push_back(words[f]);
+        pending.clear();
+}
+
+/**
+ * Encode any remaining rows and release unused capacity once
+ * decoding is done.
+ */
+void
+compact_line_table::impl::finish()
+{
+        flush();
+        pending.shrink_to_fit();
+        block_base.shrink_to_fit();
+        addr_delta.shrink_to_fit();
+        wide_addrs.shrink_to_fit();
+        line_col_file.shrink_to_fit();
+        for (auto &f : flags)
+                f.shrink_to_fit();
+        extras.shrink_to_fit();
+}
+
+size_t
+compact_line_table::size() const
+{
+        if (!m)
+                return 0;
+        return m->count;
+}
+
+taddr
+compact_line_table::address(size_t index) const
+{
+        uint32_t delta = m->addr_delta[index];
+        if (delta != impl::escape32)
+                return m->block_base[index / impl::block_size] + delta;
+        auto it = lower_bound(m->wide_addrs.begin(), m->wide_addrs.end(),
+                              make_pair(index, (taddr)0));
+        return it->second;
+}
+
+bool
+compact_line_table::end_sequence(size_t index) const
+{
+        return m->get_flag(index, impl::end_sequence);
+}
+
+line_table::entry
+compact_line_table::operator[](size_t index) const
+{
+        line_table::entry e;
+        uint64_t lcf = m->line_col_file[index];
+        e.address = address(index);
+        e.line = (uint32_t)lcf;
+        e.column = (lcf >> 32) & 0xffff;
+        e.file_index = lcf >> 48;
+        e.op_index = e.isa = e.discriminator = 0;
+        e.is_stmt = m->get_flag(index, impl::is_stmt);
+        e.basic_block = m->get_flag(index, impl::basic_block);
+        e.end_sequence = m->get_flag(index, impl::end_sequence);
+        e.prologue_end = m->get_flag(index, impl::prologue_end);
+        e.epilogue_begin = m->get_flag(index, impl::epilogue_begin);
+        if (m->get_flag(index, impl::has_extra)) {
+                auto it = lower_bound(m->extras.begin(), m->extras.end(), index,
+                                      [](const impl::extra &x, size_t row) {
+                                              return x.row < row;
+                                      });
+                e.column = it->column;
+                e.file_index = it->file_index;
+                e.op_index = it->op_index;
+                e.isa = it->isa;
+                e.discriminator = it->discriminator;
+        }
+        e.file = &(*m->files)[e.file_index];
+        return e;
+}
+
+const line_table &
+compact_line_table::get_line_table() const
+{
+        static const line_table invalid;
+        if (!m)
+                return invalid;
+        return m->table;
+}
+
+size_t
+compact_line_table::memory_usage() const
+{
+        if (!m)
+                return 0;
+        size_t bytes = sizeof(impl);
+        bytes += m->block_base.capacity() * sizeof(taddr);
+        bytes += m->addr_delta.capacity() * sizeof(uint32_t);
+        bytes += m->wide_addrs.capacity() * sizeof(m->wide_addrs[0]);
+        bytes += m->line_col_file.capacity() * sizeof(uint64_t);
+        for (auto &f : m->flags)
+                bytes += f.capacity() * sizeof(uint64_t);
+        bytes += m->extras.capacity() * sizeof(impl::extra);
+        return bytes;
+}
+
 line_table::file::file(string path, uint64_t mtime, uint64_t length)
         : path(path), mtime(mtime), length(length)
 {
@@ -268,6 +664,21 @@ line_table::iterator::iterator(const line_table *table, section_offset pos)
         }
 }
 
+line_table::iterator::iterator(const line_table *table, section_offset pos,
+                               const line_table::entry &row)
+        : table(table), entry(row), regs(row), pos(pos)
+{
+        // Reconstruct the state registers as they were just after
+        // row was emitted
+        if (row.end_sequence) {
+                regs.reset(table->m->default_is_stmt);
+        } else {
+                regs.basic_block = regs.prologue_end =
+                        regs.epilogue_begin = false;
+                regs.discriminator = 0;
+        }
+}
+
 line_table::iterator &
 line_table::iterator::operator++()
 {
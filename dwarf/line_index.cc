@@ -0,0 +1,196 @@
+// Copyright (c) 2013 Austin T. Clements. All rights reserved.
+// Use of this source code is governed by an MIT license
+// that can be found in the LICENSE file.
+
+#include "internal.hh"
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+DWARFPP_BEGIN_NAMESPACE
+
+struct line_index::impl
+{
+        // Interned source file paths
+        vector<string> paths;
+        unordered_map<string, unsigned> path_ids;
+
+        // Address ranges indexed by (path ID << 32) | line
+        unordered_map<uint64_t, vector<range> > lines;
+
+        unordered_set<section_offset> units;
+
+        unsigned intern(const string &path);
+};
+
+namespace {
+        // A line range of a single compilation unit.  file_index
+        // indexes the unit's line table.
+        struct unit_range
+        {
+                unsigned file_index, line;
+                taddr low, high;
+        };
+}
+
+unsigned
+line_index::impl::intern(const string &path)
+{
+        auto it = path_ids.find(path);
+        if (it != path_ids.end())
+                return it->second;
+        unsigned id = paths.size();
+        paths.push_back(path);
+        path_ids[path] = id;
+        return id;
+}
+
+/**
+ * Return the line ranges of table.  Each row covers the addresses up
+ * to the next row in its sequence.  Consecutive rows for the same
+ * line are coalesced and rows for line 0, which have no source line,
+ * are omitted.
+ */
+static vector<unit_range>
+read_ranges(const compact_line_table &table)
+{
+        vector<unit_range> out;
+        size_t n = table.size();
+        for (size_t i = 0; i + 1 < n; i++) {
+                if (table.end_sequence(i))
+                        continue;
+                line_table::entry row = table[i];
+                taddr high = table.address(i + 1);
+                if (row.line == 0 || row.address >= high)
+                        continue;
+                if (!out.empty()) {
+                        unit_range &last = out.back();
+                        if (last.high == row.address &&
+                            last.file_index == row.file_index &&
+                            last.line == row.line) {
+                                last.high = high;
+                                continue;
+                        }
+                }
+                out.push_back({row.file_index, row.line, row.address, high});
+        }
+        return out;
+}
+
+line_index
+line_index::from_units(const dwarf &file, unsigned nthreads)
+{
+        line_index res;
+        vector<const compilation_unit*> units;
+        for (auto &cu : file.compilation_units())
+                units.push_back(&cu);
+        res.add_units(units, nthreads);
+        return res;
+}
+
+line_index::line_index()
+        : m(make_shared<impl>())
+{
+}
+
+void
+line_index::add_unit(const compilation_unit &cu)
+{
+        add_units({&cu}, 1);
+}
+
+void
+line_index::add_units(const vector<const compilation_unit*> &units,
+                      unsigned nthreads)
+{
+        // Units are marked as indexed only once they have been
+        // merged, so a unit whose line table fails to decode can be
+        // added again later.
+        vector<const compilation_unit*> todo;
+        unordered_set<section_offset> seen;
+        for (auto cu : units) {
+                section_offset off = cu->get_section_offset();
+                if (!m->units.count(off) && seen.insert(off).second)
+                        todo.push_back(cu);
+        }
+
+        // Decode each line table independently.  Each unit is
+        // handled by exactly one thread, so it's safe for the unit
+        // to lazily load its line table.
+        vector<compact_line_table> tables(todo.size());
+        vector<vector<unit_range> > unit_ranges(todo.size());
+        parallel_for(todo.size(), nthreads, [&](size_t i) {
+                        const line_table &lt = todo[i]->get_line_table();
+                        if (!lt.valid())
+                                return;
+                        tables[i] = compact_line_table(lt);
+                        unit_ranges[i] = read_ranges(tables[i]);
+                });
+
+        // Merge the ranges into the index
+        unordered_set<uint64_t> touched;
+        for (size_t i = 0; i < todo.size(); i++) {
+                if (unit_ranges[i].empty())
+                        continue;
+                const line_table &lt = tables[i].get_line_table();
+                section_offset cu_offset = todo[i]->get_section_offset();
+                // Intern each file of this unit just once
+                vector<int> ids;
+                for (auto &r : unit_ranges[i]) {
+                        if (r.file_index >= ids.size())
+                                ids.resize(r.file_index + 1, -1);
+                        if (ids[r.file_index] == -1)
+                                ids[r.file_index] =
+                                        m->intern(lt.get_file(r.file_index)->path);
+                        uint64_t key = ((uint64_t)ids[r.file_index] << 32) | r.line;
+                        m->lines[key].push_back({r.low, r.high, cu_offset});
+                        touched.insert(key);
+                }
+        }
+
+        for (uint64_t key : touched) {
+                vector<range> &rs = m->lines[key];
+                sort(rs.begin(), rs.end(), [](const range &a, const range &b) {
+                                if (a.low != b.low)
+                                        return a.low < b.low;
+                                return a.cu_offset < b.cu_offset;
+                        });
+                vector<range> out;
+                for (auto &r : rs) {
+                        if (!out.empty() && out.back().cu_offset == r.cu_offset &&
+                            out.back().high >= r.low)
+                                out.back().high = max(out.back().high, r.high);
+                        else
+                                out.push_back(r);
+                }
+                out.shrink_to_fit();
+                rs = move(out);
+        }
+
+        for (auto cu : todo)
+                m->units.insert(cu->get_section_offset());
+}
+
+const vector<line_index::range> &
+line_index::find(const string &path, unsigned line) const
+{
+        static const vector<range> empty;
+        auto id = m->path_ids.find(path);
+        if (id == m->path_ids.end())
+                return empty;
+        auto it = m->lines.find(((uint64_t)id->second << 32) | line);
+        if (it == m->lines.end())
+                return empty;
+        return it->second;
+}
+
+const vector<string> &
+line_index::files() const
+{
+        return m->paths;
+}
+
+DWARFPP_END_NAMESPACE
@@ -0,0 +1,669 @@
+// Copyright (c) 2013 Austin T. Clements. All rights reserved.
+// Use of this source code is governed by an MIT license
+// that can be found in the LICENSE file.
+
+#include "internal.hh"
+
+#include <algorithm>
+#include <unordered_map>
+
+using namespace std;
+
+DWARFPP_BEGIN_NAMESPACE
+
+/**
+ * The source of a name index.  Each kind of name lookup table has
+ * its own implementation.
+ */
+struct name_index::impl
+{
+        virtual ~impl() { }
+
+        /**
+         * Append the entries for name to *out.
+         */
+        virtual void find(const string &name, vector<entry> *out) const = 0;
+        virtual size_t size() const = 0;
+
+        struct pub_impl;
+        struct debug_names_impl;
+        struct units_impl;
+};
+
+/**
+ * Append ent to *out unless it repeats the last entry.
+ */
+static void
+add_entry(vector<name_index::entry> *out, const name_index::entry &ent)
+{
+        if (out->empty() || out->back().die_offset != ent.die_offset)
+                out->push_back(ent);
+}
+
+//////////////////////////////////////////////////////////////////
+// .debug_pubnames and .debug_pubtypes
+//
+
+/**
+ * A name index read into a hash table from a .debug_pubnames or
+ * .debug_pubtypes section.  These sections have no hash table of
+ * their own.
+ */
+struct name_index::impl::pub_impl : public name_index::impl
+{
+        unordered_map<string, vector<name_index::entry> > names;
+
+        pub_impl(const dwarf &file, section_type type);
+
+        void find(const string &name, vector<name_index::entry> *out) const
+        {
+                auto it = names.find(name);
+                if (it != names.end())
+                        out->insert(out->end(), it->second.begin(),
+                                    it->second.end());
+        }
+
+        size_t size() const
+        {
+                return names.size();
+        }
+};
+
+name_index::impl::pub_impl::pub_impl(const dwarf &file, section_type type)
+{
+        cursor cur(file.get_section(type));
+        while (!cur.end()) {
+                // Read a name lookup table set (DWARF4 sections 6.1.1
+                // and 7.19)
+                name_unit unit;
+                unit.read(&cur);
+                name_entry ent;
+                while (!unit.entries.end()) {
+                        ent.read(&unit.entries);
+                        if (ent.offset == 0)
+                                break;
+                        // Entry offsets are relative to the unit
+                        // header.
+                        if (ent.offset >= unit.debug_info_length)
+                                throw format_error("name table entry offset 0x" +
+                                                   to_hex(ent.offset) +
+                                                   " exceeds unit length");
+                        // Some compilers list a DIE more than once
+                        add_entry(&names[ent.name],
+                                  {unit.debug_info_offset,
+                                   unit.debug_info_offset + ent.offset});
+                }
+        }
+}
+
+name_index
+name_index::from_pubnames(const dwarf &file)
+{
+        name_index res;
+        res.m = make_shared<impl::pub_impl>(file, section_type::pubnames);
+        return res;
+}
+
+name_index
+name_index::from_pubtypes(const dwarf &file)
+{
+        name_index res;
+        res.m = make_shared<impl::pub_impl>(file, section_type::pubtypes);
+        return res;
+}
+
+//////////////////////////////////////////////////////////////////
+// .debug_names
+//
+
+/**
+ * An abbreviation in a .debug_names name table.  This describes the
+ * index attributes of an entry in the entry pool.
+ */
+struct names_abbrev
+{
+        DW_TAG tag;
+        vector<pair<DW_IDX, DW_FORM> > attrs;
+};
+
+/**
+ * A name table in a .debug_names section (DWARF5 section 6.1.1.4).
+ * A section may contain several of these, for example one per
+ * compilation unit.  This records where each array of the table
+ * begins, so lookups read the section in place.
+ */
+struct names_table
+{
+        shared_ptr<section> subsec;
+        unsigned offset_size;
+        uword cu_count, local_tu_count, foreign_tu_count;
+        uword bucket_count, name_count;
+
+        // Offsets of the arrays and the entry pool in subsec
+        section_offset cus, local_tus, buckets, hashes;
+        section_offset str_offsets, entry_offsets, entry_pool;
+
+        unordered_map<uint64_t, names_abbrev> abbrevs;
+
+        explicit names_table(const shared_ptr<section> &subsec);
+
+        uword word(section_offset base, uword index) const
+        {
+                return cursor(subsec.get(),
+                              base + (section_offset)index * 4).fixed<uword>();
+        }
+
+        section_offset offset(section_offset base, uword index) const
+        {
+                return cursor(subsec.get(),
+                              base + (section_offset)index * offset_size).offset();
+        }
+
+        void read_entries(uword index, vector<name_index::entry> *out) const;
+};
+
+names_table::names_table(const shared_ptr<section> &subsec)
+        : subsec(subsec)
+{
+        // Section 6.1.1.4.1
+        cursor cur(subsec);
+        cur.skip_initial_length();
+        uhalf version = cur.fixed<uhalf>();
+        if (version != 5)
+                throw format_error("unknown name index version " +
+                                   std::to_string(version));
+        cur.fixed<uhalf>();     // Padding
+        cu_count = cur.fixed<uword>();
+        local_tu_count = cur.fixed<uword>();
+        foreign_tu_count = cur.fixed<uword>();
+        bucket_count = cur.fixed<uword>();
+        name_count = cur.fixed<uword>();
+        uword abbrev_table_size = cur.fixed<uword>();
+        uword augmentation_size = cur.fixed<uword>();
+        // This should already be a multiple of 4, but some producers
+        // record the unpadded size.
+        augmentation_size = (augmentation_size + 3) & ~3;
+
+        offset_size = subsec->fmt == format::dwarf32 ? 4 : 8;
+        section_offset pos = cur.get_section_offset() + augmentation_size;
+        cus = pos;
+        pos += (section_length)cu_count * offset_size;
+        local_tus = pos;
+        pos += (section_length)local_tu_count * offset_size;
+        pos += (section_length)foreign_tu_count * 8;
+        buckets = pos;
+        pos += (section_length)bucket_count * 4;
+        hashes = pos;
+        if (bucket_count)
+                pos += (section_length)name_count * 4;
+        str_offsets = pos;
+        pos += (section_length)name_count * offset_size;
+        entry_offsets = pos;
+        pos += (section_length)name_count * offset_size;
+        section_offset abbrev_pos = pos;
+        entry_pool = pos + abbrev_table_size;
+        if (entry_pool > (section_length)(subsec->end - subsec->begin))
+                throw format_error("name index arrays exceed section length");
+
+        // Read the abbreviation table (section 6.1.1.4.7)
+        cursor acur(subsec, abbrev_pos);
+        while (true) {
+                uint64_t code = acur.uleb128();
+                if (code == 0)
+                        break;
+                names_abbrev &abbrev = abbrevs[code];
+                abbrev.tag = (DW_TAG)acur.uleb128();
+                while (true) {
+                        DW_IDX idx = (DW_IDX)acur.uleb128();
+                        DW_FORM form = (DW_FORM)acur.uleb128();
+                        if (idx == (DW_IDX)0 && form == (DW_FORM)0)
+                                break;
+                        abbrev.attrs.push_back(make_pair(idx, form));
+                }
+        }
+        if (acur.get_section_offset() > entry_pool)
+                throw format_error("name index abbreviations exceed table size");
+}
+
+/**
+ * Read an index attribute value of the given form.
+ */
+static uint64_t
+read_idx_value(cursor *cur, DW_FORM form)
+{
+        switch (form) {
+        case DW_FORM::data1:
+        case DW_FORM::ref1:
+        case DW_FORM::flag:
+                return cur->fixed<ubyte>();
+        case DW_FORM::data2:
+        case DW_FORM::ref2:
+                return cur->fixed<uhalf>();
+        case DW_FORM::data4:
+        case DW_FORM::ref4:
+                return cur->fixed<uword>();
+        case DW_FORM::data8:
+        case DW_FORM::ref8:
+        case DW_FORM::ref_sig8:
+                return cur->fixed<uint64_t>();
+        case DW_FORM::udata:
+        case DW_FORM::ref_udata:
+                return cur->uleb128();
+        case DW_FORM::sdata:
+                return cur->sleb128();
+        case DW_FORM::flag_present:
+                return 1;
+        default:
+                throw format_error("unsupported name index form " +
+                                   to_string(form));
+        }
+}
+
+/**
+ * Append the entries of the index'th name in this table to *out.
+ */
+void
+names_table::read_entries(uword index, vector<name_index::entry> *out) const
+{
+        cursor cur(subsec, entry_pool + offset(entry_offsets, index));
+        while (true) {
+                uint64_t code = cur.uleb128();
+                if (code == 0)
+                        break;
+                auto it = abbrevs.find(code);
+                if (it == abbrevs.end())
+                        throw format_error("unknown name index abbrev code 0x" +
+                                           to_hex(code));
+
+                bool have_cu = false, have_tu = false, have_die = false;
+                uint64_t cu = 0, tu = 0, die_offset = 0;
+                for (auto &attr : it->second.attrs) {
+                        uint64_t val = read_idx_value(&cur, attr.second);
+                        switch (attr.first) {
+                        case DW_IDX::compile_unit:
+                                have_cu = true;
+                                cu = val;
+                                break;
+                        case DW_IDX::type_unit:
+                                have_tu = true;
+                                tu = val;
+                                break;
+                        case DW_IDX::die_offset:
+                                have_die = true;
+                                die_offset = val;
+                                break;
+                        default:
+                                break;
+                        }
+                }
+
+                // Find the unit containing the DIE (section
+                // 6.1.1.4.8).  A table for a single compilation unit
+                // may leave the compilation unit implicit.
+                section_offset unit_offset;
+                if (have_tu) {
+                        if (tu >= local_tu_count) {
+                                if (tu >= (uint64_t)local_tu_count + foreign_tu_count)
+                                        throw format_error("name index type unit out of range");
+                                continue;
+                        }
+                        unit_offset = offset(local_tus, tu);
+                } else {
+                        if (!have_cu && cu_count == 1)
+                                have_cu = true;
+                        if (!have_cu)
+                                throw format_error("name index entry has no unit");
+                        if (cu >= cu_count)
+                                throw format_error("name index compilation unit out of range");
+                        unit_offset = offset(cus, cu);
+                }
+                if (!have_die)
+                        throw format_error("name index entry has no DIE offset");
+                add_entry(out, {unit_offset, unit_offset + die_offset});
+        }
+}
+
+/**
+ * A name index that reads a .debug_names section in place.
+ */
+struct name_index::impl::debug_names_impl : public name_index::impl
+{
+        // The file is kept live because the tables point into its
+        // sections.
+        dwarf file;
+        shared_ptr<section> str;
+        vector<names_table> tables;
+
+        explicit debug_names_impl(const dwarf &file);
+
+        /**
+         * Return true if the string at offset off in .debug_str is
+         * name.
+         */
+        bool str_equals(section_offset off, const string &name) const
+        {
+                size_t len = name.size();
+                if (off >= (section_length)(str->end - str->begin) ||
+                    len >= (section_length)(str->end - str->begin) - off)
+                        return false;
+                const char *p = str->begin + off;
+                return p[len] == 0 && memcmp(p, name.data(), len) == 0;
+        }
+
+        void find(const string &name, vector<name_index::entry> *out) const;
+
+        size_t size() const
+        {
+                size_t n = 0;
+                for (auto &t : tables)
+                        n += t.name_count;
+                return n;
+        }
+};
+
+name_index::impl::debug_names_impl::debug_names_impl(const dwarf &file)
+        : file(file), str(file.get_section(section_type::str))
+{
+        cursor cur(file.get_section(section_type::names));
+        while (!cur.end())
+                tables.emplace_back(cur.subsection());
+}
+
+void
+name_index::impl::debug_names_impl::find(const string &name,
+                                         vector<entry> *out) const
+{
+        uint32_t hash = names_hash(name.data(), name.size());
+        for (auto &t : tables) {
+                if (t.bucket_count == 0) {
+                        // No hash table, so search the name table
+                        for (uword i = 0; i < t.name_count; i++)
+                                if (str_equals(t.offset(t.str_offsets, i), name))
+                                        t.read_entries(i, out);
+                        continue;
+                }
+
+                // Names in a bucket are contiguous and the bucket
+                // holds the 1-based index of the first one (section
+                // 6.1.1.4.5).  Different names may share a hash,
+                // so keep going after a match.
+                uword bucket = hash % t.bucket_count;
+                uword first = t.word(t.buckets, bucket);
+                if (first == 0)
+                        continue;
+                for (uword i = first - 1; i < t.name_count; i++) {
+                        uint32_t h = t.word(t.hashes, i);
+                        if (h % t.bucket_count != bucket)
+                                break;
+                        if (h == hash &&
+                            str_equals(t.offset(t.str_offsets, i), name))
+                                t.read_entries(i, out);
+                }
+        }
+}
+
+name_index
+name_index::from_debug_names(const dwarf &file)
+{
+        name_index res;
+        res.m = make_shared<impl::debug_names_impl>(file);
+        return res;
+}
+
+//////////////////////////////////////////////////////////////////
+// Compilation units
+//
+
+/**
+ * A name index built by reading every compilation unit.  Names are
+ * divided into shards by the high bits of their hash so the shards
+ * can be built in parallel.  Each shard interns its names in one
+ * string pool and finds them with an open-addressed hash table whose
+ * slots hold the full 64-bit hash, so probes rarely compare strings
+ * that don't match.
+ */
+struct name_index::impl::units_impl : public name_index::impl
+{
+        static const unsigned shard_bits = 6;
+
+        struct slot
+        {
+                uint64_t hash;
+                // The name is at name in the shard's pool and its
+                // entries are [first, first+count) in the shard's
+                // entries.  count is 0 in empty slots.
+                uint32_t name, len;
+                uint32_t first, count;
+        };
+
+        struct shard
+        {
+                string pool;
+                vector<slot> slots;
+                vector<name_index::entry> entries;
+        };
+
+        vector<shard> shards;
+        size_t name_count;
+
+        units_impl(const dwarf &file, unsigned nthreads);
+
+        void find(const string &name, vector<name_index::entry> *out) const;
+
+        size_t size() const
+        {
+                return name_count;
+        }
+};
+
+const unsigned name_index::impl::units_impl::shard_bits;
+
+namespace {
+        /**
+         * A name of a collected DIE.  If name is nullptr, the name
+         * is at offset off in the unit's pool of qualified names.
+         */
+        struct unit_name_key
+        {
+                uint64_t hash;
+                const char *name;
+                size_t off, len;
+                section_offset die_offset;
+        };
+}
+
+name_index::impl::units_impl::units_impl(const dwarf &file, unsigned nthreads)
+        : shards(1 << shard_bits), name_count(0)
+{
+        vector<const compilation_unit*> units;
+        vector<vector<indexed_name> > unit_names;
+        collect_unit_names(file, nthreads, &units, &unit_names);
+
+        // Compute the names of each unit's DIEs and sort them by
+        // shard, keeping DIE order within each shard.
+        vector<vector<unit_name_key> > unit_keys(units.size());
+        vector<string> unit_pools(units.size());
+        vector<vector<size_t> > unit_shard_starts(units.size());
+        parallel_for(units.size(), nthreads, [&](size_t u) {
+                const vector<indexed_name> &names = unit_names[u];
+                vector<unit_name_key> &keys = unit_keys[u];
+                string &pool = unit_pools[u];
+                auto add = [&](const char *name, size_t off, size_t len,
+                               const indexed_name &rec) {
+                        keys.push_back({0, name, off, len, rec.die_offset});
+                };
+
+                for (size_t i = 0; i < names.size(); i++) {
+                        const indexed_name &rec = names[i];
+                        if (rec.declaration || rec.tag == DW_TAG::namespace_ ||
+                            rec.tag == DW_TAG::label)
+                                continue;
+                        add(rec.name, 0, strlen(rec.name), rec);
+                        if (rec.linkage_name &&
+                            strcmp(rec.linkage_name, rec.name) != 0)
+                                add(rec.linkage_name, 0,
+                                    strlen(rec.linkage_name), rec);
+                        // The scopes of local names don't include
+                        // their functions, so qualifying them would
+                        // be misleading.  Inlined instances and
+                        // local class members are local but may
+                        // have ordinary scopes.
+                        if (rec.parent == indexed_name::none ||
+                            names[rec.parent].local)
+                                continue;
+                        if (rec.local && rec.tag != DW_TAG::subprogram &&
+                            rec.tag != DW_TAG::inlined_subroutine)
+                                continue;
+                        string qual = qualified_name(names, i);
+                        add(nullptr, pool.size(), qual.size(), rec);
+                        pool += qual;
+                }
+
+                for (auto &key : keys) {
+                        if (!key.name)
+                                key.name = pool.data() + key.off;
+                        key.hash = strong_string_hash(key.name, key.len);
+                }
+                stable_sort(keys.begin(), keys.end(),
+                            [](const unit_name_key &a, const unit_name_key &b) {
+                                    return (a.hash >> (64 - shard_bits)) <
+                                            (b.hash >> (64 - shard_bits));
+                            });
+                vector<size_t> &starts = unit_shard_starts[u];
+                starts.resize(shards.size() + 1);
+                size_t k = 0;
+                for (size_t sh = 0; sh <= shards.size(); sh++) {
+                        while (k < keys.size() &&
+                               (keys[k].hash >> (64 - shard_bits)) < sh)
+                                k++;
+                        starts[sh] = k;
+                }
+        });
+
+        // Build each shard from its part of every unit, in unit
+        // order
+        vector<size_t> shard_names(shards.size());
+        parallel_for(shards.size(), nthreads, [&](size_t sh) {
+                struct item
+                {
+                        const unit_name_key *key;
+                        section_offset cu_offset;
+                };
+                vector<item> items;
+                for (size_t u = 0; u < units.size(); u++) {
+                        section_offset cu_offset = units[u]->get_section_offset();
+                        const vector<size_t> &starts = unit_shard_starts[u];
+                        for (size_t k = starts[sh]; k < starts[sh + 1]; k++)
+                                items.push_back({&unit_keys[u][k], cu_offset});
+                }
+                // Group equal names, keeping their entries in order
+                stable_sort(items.begin(), items.end(),
+                            [](const item &a, const item &b) {
+                                    if (a.key->hash != b.key->hash)
+                                            return a.key->hash < b.key->hash;
+                                    if (a.key->len != b.key->len)
+                                            return a.key->len < b.key->len;
+                                    return memcmp(a.key->name, b.key->name,
+                                                  a.key->len) < 0;
+                            });
+
+                shard &out = shards[sh];
+                vector<slot> names;
+                for (size_t i = 0; i < items.size(); ) {
+                        const unit_name_key *key = items[i].key;
+                        slot sl;
+                        sl.hash = key->hash;
+                        sl.name = out.pool.size();
+                        sl.len = key->len;
+                        sl.first = out.entries.size();
+                        out.pool.append(key->name, key->len);
+                        for (; i < items.size() && items[i].key->hash == key->hash &&
+                                     items[i].key->len == key->len &&
+                                     memcmp(items[i].key->name, key->name,
+                                            key->len) == 0; i++)
+                                add_entry(&out.entries,
+                                          {items[i].cu_offset,
+                                           items[i].cu_offset + items[i].key->die_offset});
+                        sl.count = out.entries.size() - sl.first;
+                        names.push_back(sl);
+                }
+                if (out.pool.size() > 0xffffffff || out.entries.size() > 0xffffffff)
+                        throw format_error("too many names to index");
+                shard_names[sh] = names.size();
+
+                // Keep the table at most half full
+                size_t nslots = 1;
+                while (nslots < names.size() * 2)
+                        nslots *= 2;
+                out.slots.resize(names.size() ? nslots : 0);
+                for (auto &sl : names) {
+                        size_t pos = sl.hash & (nslots - 1);
+                        while (out.slots[pos].count)
+                                pos = (pos + 1) & (nslots - 1);
+                        out.slots[pos] = sl;
+                }
+        });
+        for (size_t n : shard_names)
+                name_count += n;
+}
+
+void
+name_index::impl::units_impl::find(const string &name,
+                                   vector<entry> *out) const
+{
+        uint64_t hash = strong_string_hash(name.data(), name.size());
+        const shard &sh = shards[hash >> (64 - shard_bits)];
+        if (sh.slots.empty())
+                return;
+        size_t mask = sh.slots.size() - 1;
+        for (size_t pos = hash & mask; sh.slots[pos].count;
+             pos = (pos + 1) & mask) {
+                const slot &sl = sh.slots[pos];
+                if (sl.hash == hash && sl.len == name.size() &&
+                    memcmp(sh.pool.data() + sl.name, name.data(), sl.len) == 0) {
+                        out->insert(out->end(), sh.entries.begin() + sl.first,
+                                    sh.entries.begin() + sl.first + sl.count);
+                        return;
+                }
+        }
+}
+
+name_index
+name_index::from_units(const dwarf &file, unsigned nthreads)
+{
+        name_index res;
+        res.m = make_shared<impl::units_impl>(file, nthreads);
+        return res;
+}
+
+//////////////////////////////////////////////////////////////////
+// name_index
+//
+
+vector<name_index::entry>
+name_index::find(const string &name) const
+{
+        vector<entry> res;
+        if (m)
+                m->find(name, &res);
+        return res;
+}
+
+size_t
+name_index::size() const
+{
+        if (!m)
+                return 0;
+        return m->size();
+}
+
+die
+name_index::entry::get(const dwarf &file) const
+{
+        // Look up the unit by the DIE itself, so entries whose unit
+        // offset is imprecise still resolve
+        const compilation_unit &cu = file.unit_containing(die_offset);
+        return die_ref(&cu, die_offset - cu.get_section_offset()).get();
+}
+
+DWARFPP_END_NAMESPACE
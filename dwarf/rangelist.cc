@@ -4,6 +4,8 @@
 
 #include "internal.hh"
 
+#include <algorithm>
+
 using namespace std;
 
 DWARFPP_BEGIN_NAMESPACE
@@ -11,26 +13,34 @@ DWARFPP_BEGIN_NAMESPACE
 rangelist::rangelist(const std::shared_ptr<section> &sec, section_offset off,
                      unsigned cu_addr_size, taddr cu_low_pc)
         : sec(sec->slice(off, ~0, format::unknown, cu_addr_size)),
-          base_addr(cu_low_pc)
+          base_addr(cu_low_pc), sorted(false)
 {
 }
 
 rangelist::rangelist(const initializer_list<pair<taddr, taddr> > &ranges)
+        : synthetic(make_shared<vector<taddr> >()), base_addr(0), sorted(false)
 {
-        synthetic.reserve(ranges.size() * 2 + 2);
+        synthetic->reserve(ranges.size() * 2 + 2);
         for (auto &range : ranges) {
-                synthetic.push_back(range.first);
-                synthetic.push_back(range.second);
+                synthetic->push_back(range.first);
+                synthetic->push_back(range.second);
         }
-        synthetic.push_back(0);
-        synthetic.push_back(0);
+        set_synthetic();
+}
+
+/**
+ * Terminate synthetic and point sec at it.
+ */
+void
+rangelist::set_synthetic()
+{
+        synthetic->push_back(0);
+        synthetic->push_back(0);
 
         sec = make_shared<section>(
-                section_type::ranges, (const char*)synthetic.data(),
-                synthetic.size() * sizeof(taddr),
+                section_type::ranges, (const char*)synthetic->data(),
+                synthetic->size() * sizeof(taddr),
                 native_order(), format::unknown, sizeof(taddr));
-
-        base_addr = 0;
 }
 
 rangelist::iterator
@@ -50,12 +60,55 @@ rangelist::end() const
 bool
 rangelist::contains(taddr addr) const
 {
+        if (sorted) {
+                // Find the last range whose low address is <= addr.
+                // The pairs are followed by the {0, 0} terminator.
+                const taddr *ranges = synthetic->data();
+                size_t lo = 0, hi = synthetic->size() / 2 - 1;
+                while (lo < hi) {
+                        size_t mid = lo + (hi - lo) / 2;
+                        if (ranges[mid * 2] <= addr)
+                                lo = mid + 1;
+                        else
+                                hi = mid;
+                }
+                return lo > 0 && addr < ranges[lo * 2 - 1];
+        }
+
         for (auto ent : *this)
                 if (ent.contains(addr))
                         return true;
         return false;
 }
 
+rangelist
+rangelist::materialize() const
+{
+        vector<pair<taddr, taddr> > ranges;
+        for (auto &ent : *this)
+                if (ent.low < ent.high)
+                        ranges.emplace_back(ent.low, ent.high);
+        sort(ranges.begin(), ranges.end());
+
+        rangelist res;
+        res.synthetic = make_shared<vector<taddr> >();
+        vector<taddr> &out = *res.synthetic;
+        // Leave room for the terminator added by set_synthetic
+        out.reserve(ranges.size() * 2 + 2);
+        for (auto &range : ranges) {
+                if (!out.empty() && range.first <= out.back()) {
+                        // Overlaps or abuts the previous range
+                        out.back() = max(out.back(), range.second);
+                } else {
+                        out.push_back(range.first);
+                        out.push_back(range.second);
+                }
+        }
+        res.set_synthetic();
+        res.sorted = true;
+        return res;
+}
+
 rangelist::iterator::iterator(const std::shared_ptr<section> &sec, taddr base_addr)
         : sec(sec), base_addr(base_addr), pos(0)
 {
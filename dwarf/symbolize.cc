@@ -0,0 +1,118 @@
+// Copyright (c) 2013 Austin T. Clements. All rights reserved.
+// Use of this source code is governed by an MIT license
+// that can be found in the LICENSE file.
+
+#include "internal.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+DWARFPP_BEGIN_NAMESPACE
+
+/**
+ * Reset the file, line, and frames of the results for by_unit[begin,
+ * end), leaving their unit.
+ */
+static void
+clear_group(vector<symbolized_pc> *res,
+            const vector<pair<section_offset, size_t> > &by_unit,
+            size_t begin, size_t end)
+{
+        for (size_t i = begin; i < end; i++) {
+                symbolized_pc &r = (*res)[by_unit[i].second];
+                r.file = nullptr;
+                r.line = r.column = 0;
+                r.frames.clear();
+        }
+}
+
+void
+symbolize(const dwarf &file, const taddr *pcs, size_t count,
+          vector<symbolized_pc> *out, unsigned nthreads)
+{
+        // Symbolize each distinct address once
+        vector<taddr> uniq(pcs, pcs + count);
+        sort(uniq.begin(), uniq.end());
+        uniq.erase(unique(uniq.begin(), uniq.end()), uniq.end());
+
+        vector<symbolized_pc> res(uniq.size());
+        for (auto &r : res) {
+                r.cu = nullptr;
+                r.file = nullptr;
+                r.line = r.column = 0;
+        }
+
+        // Group the addresses by unit.  Units may cover several
+        // disjoint ranges, so sort by unit, keeping each group in
+        // address order.
+        const address_index &addrs = file.get_address_index();
+        vector<pair<section_offset, size_t> > by_unit;
+        by_unit.reserve(uniq.size());
+        for (size_t i = 0; i < uniq.size(); i++) {
+                section_offset cu_offset;
+                if (addrs.find(uniq[i], &cu_offset))
+                        by_unit.push_back(make_pair(cu_offset, i));
+        }
+        sort(by_unit.begin(), by_unit.end());
+        vector<size_t> group_starts;
+        for (size_t i = 0; i < by_unit.size(); i++)
+                if (i == 0 || by_unit[i].first != by_unit[i - 1].first)
+                        group_starts.push_back(i);
+        group_starts.push_back(by_unit.size());
+
+        // Each group has its own unit and its own results, so
+        // groups can be processed independently
+        parallel_for(group_starts.size() - 1, nthreads, [&](size_t g) {
+                size_t begin = group_starts[g], end = group_starts[g + 1];
+                const compilation_unit *cu;
+                try {
+                        cu = &file.find_unit_by_offset(by_unit[begin].first);
+                } catch (out_of_range &e) {
+                        // The address index names a unit that
+                        // doesn't exist
+                        return;
+                }
+                for (size_t i = begin; i < end; i++)
+                        res[by_unit[i].second].cu = cu;
+
+                // Malformed debug info in one unit shouldn't cost
+                // the results for every other unit, so leave this
+                // group's locations and frames empty instead
+                try {
+                        const line_table &lt = cu->get_line_table();
+                        if (lt.valid())
+                                lt.enable_address_index();
+                        function_index functions(*cu);
+
+                        for (size_t i = begin; i < end; i++) {
+                                taddr pc = uniq[by_unit[i].second];
+                                symbolized_pc &r = res[by_unit[i].second];
+                                if (lt.valid()) {
+                                        auto it = lt.find_address(pc);
+                                        if (it != lt.end()) {
+                                                r.file = it->file;
+                                                r.line = it->line;
+                                                r.column = it->column;
+                                        }
+                                }
+                                functions.find(pc, &r.frames);
+                        }
+                } catch (format_error &e) {
+                        clear_group(&res, by_unit, begin, end);
+                } catch (out_of_range &e) {
+                        clear_group(&res, by_unit, begin, end);
+                } catch (value_type_mismatch &e) {
+                        clear_group(&res, by_unit, begin, end);
+                }
+        });
+
+        out->resize(count);
+        for (size_t i = 0; i < count; i++) {
+                size_t j = lower_bound(uniq.begin(), uniq.end(), pcs[i]) -
+                        uniq.begin();
+                (*out)[i] = res[j];
+        }
+}
+
+DWARFPP_END_NAMESPACE
@@ -184,14 +184,15 @@ value::as_reference() const
 
         case DW_FORM::ref_addr: {
                 off = cur.offset();
-                // These seem to be extremely rare in practice (I
-                // haven't been able to get gcc to produce a
-                // ref_addr), so it's not worth caching this lookup.
-                const compilation_unit *base_cu = nullptr;
-                for (auto &file_cu : cu->get_dwarf().compilation_units()) {
-                        if (file_cu.get_section_offset() > off)
-                                break;
-                        base_cu = &file_cu;
+                // These are common in dwz-compressed and LTO
+                // binaries, so this binary searches the unit
+                // offsets rather than constructing every unit.
+                const compilation_unit *base_cu;
+                try {
+                        base_cu = &cu->get_dwarf().unit_containing(off);
+                } catch (std::out_of_range &e) {
+                        throw format_error("reference 0x" + to_hex(off) +
+                                           " outside .debug_info");
                 }
                 die d(base_cu);
                 d.read(off - base_cu->get_section_offset());
@@ -0,0 +1,39 @@
+#include "elf++.hh"
+#include "dwarf++.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+
+using namespace std;
+
+int
+main(int argc, char **argv)
+{
+        if (argc != 2) {
+                fprintf(stderr, "usage: %s elf-file\n", argv[0]);
+                return 2;
+        }
+
+        int fd = open(argv[1], O_RDONLY);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+                return 1;
+        }
+
+        elf::elf ef(elf::create_mmap_loader(fd));
+        dwarf::dwarf dw(dwarf::elf::create_loader(ef));
+
+        auto &index = dw.get_address_index();
+        for (auto &range : index.ranges())
+                printf("%#18" PRIx64 " %#18" PRIx64 " <%" PRIx64 ">\n",
+                       range.low, range.high, range.cu_offset);
+        for (auto &range : index.gaps())
+                printf("gap     %#18" PRIx64 " %#18" PRIx64 " <%" PRIx64 ">\n",
+                       range.low, range.high, range.cu_offset);
+        for (auto &range : index.overlaps())
+                printf("overlap %#18" PRIx64 " %#18" PRIx64 " <%" PRIx64 ">\n",
+                       range.low, range.high, range.cu_offset);
+
+        return 0;
+}
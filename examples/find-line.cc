@@ -0,0 +1,74 @@
+#include "elf++.hh"
+#include "dwarf++.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string>
+#include <inttypes.h>
+
+using namespace std;
+
+void
+usage(const char *cmd) 
+{
+        fprintf(stderr, "usage: %s elf-file path:line\n", cmd);
+        exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+        if (argc != 3)
+                usage(argv[0]);
+
+        string arg(argv[2]);
+        size_t colon = arg.rfind(':');
+        if (colon == string::npos)
+                usage(argv[0]);
+        string path = arg.substr(0, colon);
+        unsigned line;
+        try {
+                line = stoul(arg.substr(colon + 1), nullptr, 0);
+        } catch (invalid_argument &e) {
+                usage(argv[0]);
+        } catch (out_of_range &e) {
+                usage(argv[0]);
+        }
+
+        int fd = open(argv[1], O_RDONLY);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+                return 1;
+        }
+
+        elf::elf ef(elf::create_mmap_loader(fd));
+        dwarf::dwarf dw(dwarf::elf::create_loader(ef));
+
+        auto index = dwarf::line_index::from_units(dw);
+
+        // Line tables record absolute paths, so also accept a path
+        // suffix if it names exactly one file
+        if (index.find(path, line).empty()) {
+                string match;
+                for (auto &p : index.files()) {
+                        if (p.size() > path.size() &&
+                            p.compare(p.size() - path.size(), path.size(), path) == 0 &&
+                            p[p.size() - path.size() - 1] == '/') {
+                                if (!match.empty()) {
+                                        fprintf(stderr, "%s is ambiguous\n",
+                                                path.c_str());
+                                        return 1;
+                                }
+                                match = p;
+                        }
+                }
+                if (!match.empty())
+                        path = match;
+        }
+
+        for (auto &r : index.find(path, line))
+                printf("%#18" PRIx64 " %#18" PRIx64 " <%" PRIx64 ">\n",
+                       r.low, r.high, r.cu_offset);
+
+        return 0;
+}
@@ -0,0 +1,91 @@
+#include "elf++.hh"
+#include "dwarf++.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string>
+#include <inttypes.h>
+
+using namespace std;
+
+void
+usage(const char *cmd) 
+{
+        fprintf(stderr, "usage: %s elf-file name\n", cmd);
+        exit(2);
+}
+
+void
+dump_die(const dwarf::die &node)
+{
+        printf("<%" PRIx64 "> %s\n",
+               node.get_section_offset(),
+               to_string(node.tag).c_str());
+        for (auto attr : node.each_attribute())
+                printf("      %s %s\n",
+                       to_string(attr.first).c_str(),
+                       to_string(attr.second).c_str());
+}
+
+int
+main(int argc, char **argv)
+{
+        if (argc != 3)
+                usage(argv[0]);
+
+        int fd = open(argv[1], O_RDONLY);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+                return 1;
+        }
+
+        elf::elf ef(elf::create_mmap_loader(fd));
+        dwarf::dwarf dw(dwarf::elf::create_loader(ef),
+                        dwarf::unit_discovery::lazy);
+
+        // Look the name up in each name lookup table.  Only the
+        // units that define it get read.
+        bool have_table = false;
+        for (auto type : {dwarf::section_type::names,
+                                dwarf::section_type::pubnames,
+                                dwarf::section_type::pubtypes}) {
+                dwarf::name_index index;
+                try {
+                        if (type == dwarf::section_type::names)
+                                index = dwarf::name_index::from_debug_names(dw);
+                        else if (type == dwarf::section_type::pubnames)
+                                index = dwarf::name_index::from_pubnames(dw);
+                        else
+                                index = dwarf::name_index::from_pubtypes(dw);
+                } catch (dwarf::format_error &e) {
+                        fprintf(stderr, "%s\n", e.what());
+                        continue;
+                }
+                have_table = true;
+                for (auto &ent : index.find(argv[2]))
+                        dump_die(ent.get(dw));
+        }
+
+        // .gdb_index only records the units that define a name
+        try {
+                dwarf::gdb_index gdb_index(dw);
+                have_table = true;
+                for (auto &sym : gdb_index.find(argv[2]))
+                        printf("%s unit <%" PRIx64 "> %s%s\n",
+                               sym.type_unit ? "type" : "compilation",
+                               sym.unit_offset,
+                               to_string(sym.kind).c_str(),
+                               sym.is_static ? " static" : "");
+        } catch (dwarf::format_error &e) {
+                fprintf(stderr, "%s\n", e.what());
+        }
+
+        // Without any tables, index every unit
+        if (!have_table) {
+                auto index = dwarf::name_index::from_units(dw);
+                for (auto &ent : index.find(argv[2]))
+                        dump_die(ent.get(dw));
+        }
+
+        return 0;
+}
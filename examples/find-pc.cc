@@ -15,42 +15,13 @@ usage(const char *cmd)
         exit(2);
 }
 
-bool
-find_pc(const dwarf::die &d, dwarf::taddr pc, vector<dwarf::die> *stack)
-{
-        using namespace dwarf;
-
-        // Scan children first to find most specific DIE
-        bool found = false;
-        for (auto &child : d) {
-                if ((found = find_pc(child, pc, stack)))
-                        break;
-        }
-        switch (d.tag) {
-        case DW_TAG::subprogram:
-        case DW_TAG::inlined_subroutine:
-                try {
-                        if (found || die_pc_range(d).contains(pc)) {
-                                found = true;
-                                stack->push_back(d);
-                        }
-                } catch (out_of_range &e) {
-                } catch (value_type_mismatch &e) {
-                }
-                break;
-        default:
-                break;
-        }
-        return found;
-}
-
 void
 dump_die(const dwarf::die &node)
 {
         printf("<%" PRIx64 "> %s\n",
                node.get_section_offset(),
                to_string(node.tag).c_str());
-        for (auto &attr : node.attributes())
+        for (auto attr : node.each_attribute())
                 printf("      %s %s\n",
                        to_string(attr.first).c_str(),
                        to_string(attr.second).c_str());
@@ -78,35 +49,45 @@ main(int argc, char **argv)
         }
 
         elf::elf ef(elf::create_mmap_loader(fd));
-        dwarf::dwarf dw(dwarf::elf::create_loader(ef));
+        dwarf::dwarf dw(dwarf::elf::create_loader(ef),
+                        dwarf::unit_discovery::lazy);
+
+        // Find the CU containing pc.  Use the linker's .gdb_index if
+        // there is one, since it needs no construction.
+        dwarf::section_offset cu_offset;
+        bool found;
+        try {
+                found = dwarf::gdb_index(dw).find_address(pc, &cu_offset);
+        } catch (dwarf::format_error &e) {
+                found = dw.get_address_index().find(pc, &cu_offset);
+        }
+        if (!found)
+                return 0;
+        auto &cu = dw.find_unit_by_offset(cu_offset);
 
-        // Find the CU containing pc
-        // XXX Use .debug_aranges
-        for (auto &cu : dw.compilation_units()) {
-                if (die_pc_range(cu.root()).contains(pc)) {
-                        // Map PC to a line
-                        auto &lt = cu.get_line_table();
-                        auto it = lt.find_address(pc);
-                        if (it == lt.end())
-                                printf("UNKNOWN\n");
-                        else
-                                printf("%s\n",
-                                       it->get_description().c_str());
+        // Map PC to a line
+        auto &lt = cu.get_line_table();
+        auto it = lt.find_address(pc);
+        if (it == lt.end())
+                printf("UNKNOWN\n");
+        else
+                printf("%s\n",
+                       it->get_description().c_str());
 
-                        // Map PC to an object
-                        // XXX Index/helper/something for looking up PCs
-                        // XXX DW_AT_specification and DW_AT_abstract_origin
-                        vector<dwarf::die> stack;
-                        if (find_pc(cu.root(), pc, &stack)) {
-                                bool first = true;
-                                for (auto &d : stack) {
-                                        if (!first)
-                                                printf("\nInlined in:\n");
-                                        first = false;
-                                        dump_die(d);
-                                }
-                        }
-                        break;
+        // Map PC to an object and the functions it was inlined into
+        // XXX DW_AT_specification and DW_AT_abstract_origin
+        vector<dwarf::function_index::frame> stack;
+        if (dwarf::function_index(cu).find(pc, &stack)) {
+                bool first = true;
+                for (auto &fr : stack) {
+                        if (!first)
+                                printf("\nInlined in:\n");
+                        first = false;
+                        dump_die(fr.function.get());
+                        if (fr.call_file)
+                                printf("      called from %s:%u\n",
+                                       fr.call_file->path.c_str(),
+                                       fr.call_line);
                 }
         }
 
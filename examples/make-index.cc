@@ -0,0 +1,69 @@
+#include "elf++.hh"
+#include "dwarf++.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string>
+
+using namespace std;
+
+void
+usage(const char *cmd) 
+{
+        fprintf(stderr, "usage: %s --debug-names|--gdb-index elf-file out-file\n", cmd);
+        exit(2);
+}
+
+bool
+write_file(const string &path, const vector<char> &data)
+{
+        FILE *f = fopen(path.c_str(), "wb");
+        if (!f || fwrite(data.data(), 1, data.size(), f) != data.size() ||
+            fclose(f) != 0) {
+                fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+                return false;
+        }
+        return true;
+}
+
+int
+main(int argc, char **argv)
+{
+        if (argc != 4)
+                usage(argv[0]);
+        string kind(argv[1]);
+        if (kind != "--debug-names" && kind != "--gdb-index")
+                usage(argv[0]);
+        string out(argv[3]);
+
+        int fd = open(argv[2], O_RDONLY);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+                return 1;
+        }
+
+        elf::elf ef(elf::create_mmap_loader(fd));
+        dwarf::dwarf dw(dwarf::elf::create_loader(ef));
+
+        // Print the objcopy command that attaches the new sections
+        if (kind == "--gdb-index") {
+                if (!write_file(out, dwarf::write_gdb_index(dw)))
+                        return 1;
+                printf("objcopy --add-section .gdb_index=%s %s\n",
+                       out.c_str(), argv[2]);
+        } else {
+                vector<char> str;
+                if (!write_file(out, dwarf::write_debug_names(dw, &str)))
+                        return 1;
+                printf("objcopy --add-section .debug_names=%s", out.c_str());
+                if (!str.empty()) {
+                        if (!write_file(out + ".str", str))
+                                return 1;
+                        printf(" --update-section .debug_str=%s.str",
+                               out.c_str());
+                }
+                printf(" %s\n", argv[2]);
+        }
+
+        return 0;
+}
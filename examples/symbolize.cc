@@ -0,0 +1,89 @@
+#include "elf++.hh"
+#include "dwarf++.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string>
+#include <inttypes.h>
+
+using namespace std;
+
+void
+usage(const char *cmd) 
+{
+        fprintf(stderr, "usage: %s elf-file < pcs\n", cmd);
+        exit(2);
+}
+
+/**
+ * Return the name of a function DIE, following the references from
+ * inlined and out-of-line instances to the DIE that names them.
+ */
+string
+function_name(dwarf::die d)
+{
+        using namespace dwarf;
+
+        for (int hop = 0; d.valid() && hop < 8; hop++) {
+                if (d.has(DW_AT::name))
+                        return at_name(d);
+                if (d.has(DW_AT::abstract_origin))
+                        d = at_abstract_origin(d);
+                else if (d.has(DW_AT::specification))
+                        d = at_specification(d);
+                else
+                        break;
+        }
+        return "??";
+}
+
+int
+main(int argc, char **argv)
+{
+        if (argc != 2)
+                usage(argv[0]);
+
+        // Read one address per line
+        vector<dwarf::taddr> pcs;
+        char buf[64];
+        while (fgets(buf, sizeof buf, stdin)) {
+                try {
+                        pcs.push_back(stoull(buf, nullptr, 0));
+                } catch (invalid_argument &e) {
+                        usage(argv[0]);
+                } catch (out_of_range &e) {
+                        usage(argv[0]);
+                }
+        }
+
+        int fd = open(argv[1], O_RDONLY);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+                return 1;
+        }
+
+        elf::elf ef(elf::create_mmap_loader(fd));
+        dwarf::dwarf dw(dwarf::elf::create_loader(ef),
+                        dwarf::unit_discovery::lazy);
+
+        vector<dwarf::symbolized_pc> syms;
+        dwarf::symbolize(dw, pcs.data(), pcs.size(), &syms);
+
+        for (size_t i = 0; i < pcs.size(); i++) {
+                auto &sym = syms[i];
+                printf("%#" PRIx64 " %s:%u", pcs[i],
+                       sym.file ? sym.file->path.c_str() : "??", sym.line);
+                // Print the function, then where each inlined
+                // instance was called from
+                for (auto &fr : sym.frames) {
+                        printf(" %s", function_name(fr.function.get()).c_str());
+                        if (fr.call_file)
+                                printf(" (inlined at %s:%u)",
+                                       fr.call_file->path.c_str(),
+                                       fr.call_line);
+                }
+                printf("\n");
+        }
+
+        return 0;
+}
@@ -7,23 +7,65 @@ die() {
 
 (cd ../examples && make --quiet) || die "failed to build examples"
 
-dumps="sections segments lines syms tree"
+dumps="sections segments lines syms tree aranges symbolize find-name find-name-indexed"
 binaries=example
 compilers="gcc-4.9.2 gcc-6.2.1-s390x"
 
+# Write a copy of binary $1 to $2 with .debug_names and .gdb_index
+# sections generated by make-index.
+add_index() {
+    ../examples/make-index --debug-names $1 $2.names > /dev/null || return
+    ../examples/make-index --gdb-index $1 $2.gdb > /dev/null || return
+    # objcopy may not know the binary's machine, so use the generic
+    # ELF target for its class and byte order
+    local class=$(od -An -tu1 -j4 -N1 $1) data=$(od -An -tu1 -j5 -N1 $1)
+    local bfd=elf$((class * 32))-$([[ $data -eq 2 ]] && echo big || echo little)
+    local str=
+    if [[ -e $2.names.str ]]; then
+        str="--update-section .debug_str=$2.names.str"
+    fi
+    objcopy -I $bfd -O $bfd --add-section .debug_names=$2.names $str \
+        --add-section .gdb_index=$2.gdb $1 $2
+}
+
+# Run the example for a dump on a binary.  symbolize reads the
+# addresses of the binary's line table rows.  find-name looks up the
+# functions of example.c, and find-name-indexed does the same using
+# generated name tables.
+run_dump() {
+    case $1 in
+    symbolize)
+        ../examples/dump-lines $2 | awk '$NF ~ /^0x/ {print $NF}' | \
+            ../examples/symbolize $2
+        ;;
+    find-name)
+        for name in fib main; do
+            ../examples/find-name $2 $name || return
+        done
+        ;;
+    find-name-indexed)
+        add_index $2 $output.elf || return
+        run_dump find-name $output.elf
+        ;;
+    *)
+        ../examples/dump-$1 $2
+        ;;
+    esac
+}
+
 if [[ $1 == --make-golden ]]; then
     MODE=make-golden
 fi
 
 output=$(mktemp --tmpdir libelfin.XXXXXXXXXX)
-trap "rm -f $output $output.out" EXIT
+trap "rm -f $output $output.out $output.elf*" EXIT
 
 FAILED=0
 for dump in $dumps; do
     for binary in $binaries; do
         for compiler in $compilers; do
             if [[ $MODE == make-golden ]]; then
-                ../examples/dump-$dump golden-$compiler/$binary > golden-$compiler/$dump || \
+                run_dump $dump golden-$compiler/$binary &> golden-$compiler/$dump || \
                     die "failed to create golden output"
                 continue
             fi
@@ -34,7 +76,7 @@ for dump in $dumps; do
             exec 3>&1 4>&2 1>$output 2>&1
 
             # Run the test.
-            ../examples/dump-$dump golden-$compiler/$binary >& $output.out
+            run_dump $dump golden-$compiler/$binary >& $output.out
             STATUS=$?
             if [[ $STATUS != 0 ]]; then
                 PASS=0
@@ -54,7 +96,14 @@ for dump in $dumps; do
             else
                 echo -n "PASS "
             fi
-            echo dump-$dump golden-$compiler/$binary
+            case $dump in
+            symbolize|find-name*)
+                echo $dump golden-$compiler/$binary
+                ;;
+            *)
+                echo dump-$dump golden-$compiler/$binary
+                ;;
+            esac
 
             if [[ $PASS == 0 ]]; then
                 sed 's/^/\t/' $output